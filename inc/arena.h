@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Bump allocator that hands out memory from large chunks, all of which are released at once when it is destroyed
+// Individual allocations are never freed, so it is intended for objects that mostly live as long as the arena
+class arena {
+public:
+	arena(size_t chunk_size = 64 * 1024) : chunk_size(chunk_size) {}
+
+	arena(arena const&) = delete;
+	auto operator=(arena const&) -> arena& = delete;
+
+	auto allocate(size_t size, size_t alignment = alignof(std::max_align_t)) -> void*;
+
+	// Total number of bytes handed out, including padding
+	auto bytes_allocated() const -> size_t {
+		return num_bytes;
+	}
+
+	// Returns the arena that has been made current on this thread, or nullptr if there is none
+	static auto current() -> arena*;
+
+	// Makes an arena current on this thread until the scope is destroyed, restoring the previous one afterwards
+	class scope {
+	public:
+		scope(arena& a);
+		~scope();
+
+		scope(scope const&) = delete;
+		auto operator=(scope const&) -> scope& = delete;
+
+	private:
+		arena* previous;
+	};
+
+private:
+	size_t chunk_size;
+	std::vector<std::unique_ptr<char[]>> chunks;
+	char* next = nullptr;
+	char* end = nullptr;
+	size_t num_bytes = 0;
+};
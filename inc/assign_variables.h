@@ -23,8 +23,8 @@ public:
 	};
 	using assignment = std::tuple<std::string, bitrange>;
 
-	auto get_assignment(std::string variable) -> assignment;
+	auto get_assignment(ast::symbol variable) -> assignment;
 
 private:
-	std::map<std::string, assignment> assignments;
+	std::map<ast::symbol, assignment> assignments;
 };
@@ -1,12 +1,17 @@
 #pragma once
 
+#include "symbol.h"
+
 #include <string>
+#include <string_view>
 #include <vector>
 #include <variant>
 #include <memory>
 #include <functional>
-#include <typeinfo>
 #include <map>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
 
 namespace ast {
 	using std::string;
@@ -17,54 +22,162 @@ namespace ast {
 	using std::function;
 	using std::map;
 
-	struct node {
-		virtual ~node() {}
-		virtual auto get_id() -> size_t = 0;
-		virtual auto parent() -> node*& = 0;
-		virtual auto filename() -> string& = 0;
-		virtual auto line() -> size_t& = 0;
-		virtual auto col() -> size_t& = 0;
+	// Files that nodes were parsed from, so that each node only needs to store a small index
+	// Index 0 is the empty name, used for nodes that were not parsed from any file
+	// Every parse of a file adds a new entry, so that compilations parsing different contents of the same file
+	//  resolve the positions of their nodes independently
+	struct file_table {
+		using file_id = uint32_t;
+
+		// Returns the id of the new entry along with a handle to the contents, which are viewed in place and kept
+		//  valid by owner for as long as the handle is alive. The table does not keep the handle alive, so whoever
+		//  owns the nodes must also own it. Once it is released, the entry is cleared and its id is given to a later file
+		static auto add(string const& filename, std::string_view contents, std::shared_ptr<void const> owner)
+			-> std::pair<file_id, std::shared_ptr<std::string_view const>>;
+		static auto name(file_id id) -> string const&;
+
+		// Returns the line and column (both starting at 1) of the byte at the offset, or 0, 0 if the contents of
+		//  the file are no longer alive. The index of line starts of a file is only built when it is first needed
+		static auto resolve(file_id id, uint32_t offset) -> std::pair<size_t, size_t>;
 	};
 
+	// The bytes of its file that a node was parsed from
+	struct source_span {
+		uint32_t offset = 0;
+		uint32_t length = 0;
+	};
+
+	// Every concrete type of AST node, used as a dense tag so that checking the type of a node is a single compare
+	struct val_bool; struct val_float; struct val_int; struct ty_bool; struct ty_float; struct ty_int;
+	struct variable_type; struct variable_decl; struct properties; struct field; struct arithmetic_value; struct arithmetic;
+	struct add; struct mul; struct sub; struct div; struct mod; struct exp;
+	struct comparison; struct logical; struct and_op; struct or_op; struct negated; struct assignment;
+	struct continuous_if; struct transition_if; struct for_in; struct always_body; struct trait; struct trait_initializer;
+	struct unit_traits; struct program;
+
+	enum class node_kind : uint8_t {
+		VAL_BOOL, VAL_FLOAT, VAL_INT, TY_BOOL, TY_FLOAT, TY_INT,
+		VARIABLE_TYPE, VARIABLE_DECL, PROPERTIES, FIELD, ARITHMETIC_VALUE, ARITHMETIC,
+		ADD, MUL, SUB, DIV, MOD, EXP,
+		COMPARISON, LOGICAL, AND_OP, OR_OP, NEGATED, ASSIGNMENT,
+		CONTINUOUS_IF, TRANSITION_IF, FOR_IN, ALWAYS_BODY, TRAIT, TRAIT_INITIALIZER,
+		UNIT_TRAITS, PROGRAM
+	};
+
+	// Left undefined so that a node type missing from node_kind fails to compile
 	template <typename Impl>
-	struct node_impl : node {
-		static auto id() -> size_t {
-			return typeid(Impl).hash_code();
+	struct kind_of;
+	template <> struct kind_of<val_bool> : std::integral_constant<node_kind, node_kind::VAL_BOOL> {};
+	template <> struct kind_of<val_float> : std::integral_constant<node_kind, node_kind::VAL_FLOAT> {};
+	template <> struct kind_of<val_int> : std::integral_constant<node_kind, node_kind::VAL_INT> {};
+	template <> struct kind_of<ty_bool> : std::integral_constant<node_kind, node_kind::TY_BOOL> {};
+	template <> struct kind_of<ty_float> : std::integral_constant<node_kind, node_kind::TY_FLOAT> {};
+	template <> struct kind_of<ty_int> : std::integral_constant<node_kind, node_kind::TY_INT> {};
+	template <> struct kind_of<variable_type> : std::integral_constant<node_kind, node_kind::VARIABLE_TYPE> {};
+	template <> struct kind_of<variable_decl> : std::integral_constant<node_kind, node_kind::VARIABLE_DECL> {};
+	template <> struct kind_of<properties> : std::integral_constant<node_kind, node_kind::PROPERTIES> {};
+	template <> struct kind_of<field> : std::integral_constant<node_kind, node_kind::FIELD> {};
+	template <> struct kind_of<arithmetic_value> : std::integral_constant<node_kind, node_kind::ARITHMETIC_VALUE> {};
+	template <> struct kind_of<arithmetic> : std::integral_constant<node_kind, node_kind::ARITHMETIC> {};
+	template <> struct kind_of<add> : std::integral_constant<node_kind, node_kind::ADD> {};
+	template <> struct kind_of<mul> : std::integral_constant<node_kind, node_kind::MUL> {};
+	template <> struct kind_of<sub> : std::integral_constant<node_kind, node_kind::SUB> {};
+	template <> struct kind_of<div> : std::integral_constant<node_kind, node_kind::DIV> {};
+	template <> struct kind_of<mod> : std::integral_constant<node_kind, node_kind::MOD> {};
+	template <> struct kind_of<exp> : std::integral_constant<node_kind, node_kind::EXP> {};
+	template <> struct kind_of<comparison> : std::integral_constant<node_kind, node_kind::COMPARISON> {};
+	template <> struct kind_of<logical> : std::integral_constant<node_kind, node_kind::LOGICAL> {};
+	template <> struct kind_of<and_op> : std::integral_constant<node_kind, node_kind::AND_OP> {};
+	template <> struct kind_of<or_op> : std::integral_constant<node_kind, node_kind::OR_OP> {};
+	template <> struct kind_of<negated> : std::integral_constant<node_kind, node_kind::NEGATED> {};
+	template <> struct kind_of<assignment> : std::integral_constant<node_kind, node_kind::ASSIGNMENT> {};
+	template <> struct kind_of<continuous_if> : std::integral_constant<node_kind, node_kind::CONTINUOUS_IF> {};
+	template <> struct kind_of<transition_if> : std::integral_constant<node_kind, node_kind::TRANSITION_IF> {};
+	template <> struct kind_of<for_in> : std::integral_constant<node_kind, node_kind::FOR_IN> {};
+	template <> struct kind_of<always_body> : std::integral_constant<node_kind, node_kind::ALWAYS_BODY> {};
+	template <> struct kind_of<trait> : std::integral_constant<node_kind, node_kind::TRAIT> {};
+	template <> struct kind_of<trait_initializer> : std::integral_constant<node_kind, node_kind::TRAIT_INITIALIZER> {};
+	template <> struct kind_of<unit_traits> : std::integral_constant<node_kind, node_kind::UNIT_TRAITS> {};
+	template <> struct kind_of<program> : std::integral_constant<node_kind, node_kind::PROGRAM> {};
+
+	struct node {
+		node(node_kind kind) : kind_(kind) {}
+		virtual ~node() {}
+
+		auto get_id() const -> node_kind {
+			return kind_;
 		}
 
-		static auto make() -> unique_ptr<Impl> {
-			return make_unique<Impl>();
+		// Nodes are allocated from the current arena if there is one, in which case deleting a node only
+		//  runs its destructor and the memory is released along with the arena
+		static auto operator new(size_t size) -> void*;
+		static void operator delete(void* ptr, size_t size);
+
+		auto parent() -> node*& {
+			return parent_;
 		}
 
-		virtual auto clone() -> unique_ptr<Impl> {
-			return make_unique<Impl>();
+		auto file() -> file_table::file_id& {
+			return file_;
 		}
 
-		virtual auto get_id() -> size_t {
-			return id();
+		auto span() -> source_span& {
+			return span_;
 		}
 
-		virtual auto parent() -> node*& {
-			return parent_;
+		auto filename() -> string const& {
+			return file_table::name(file_);
+		}
+
+		// Diagnostics are located at the end of the span of a node, which is only resolved when they are reported
+		auto line() -> size_t {
+			return file_table::resolve(file_, span_.offset + span_.length).first;
+		}
+
+		auto col() -> size_t {
+			return file_table::resolve(file_, span_.offset + span_.length).second;
 		}
 
-		virtual auto filename() -> string& {
-			return filename_;
+		// Whether the node was created or moved since the program was last checked, and whether any of its
+		//  descendants were, which lets the semantic checker only check the parts of the program passes changed
+		auto changed() const -> bool {
+			return changed_;
 		}
 
-		virtual auto line() -> size_t& {
-			return line_;
+		auto changed_below() const -> bool {
+			return changed_below_;
 		}
 
-		virtual auto col() -> size_t& {
-			return col_;
+		void clear_changed() {
+			changed_ = changed_below_ = false;
 		}
 
 	private:
-		node* parent_;
-		string filename_;
-		size_t line_;
-		size_t col_;
+		friend void mark_changed(node& n);
+
+		node_kind kind_;
+		bool changed_ = true;
+		bool changed_below_ = true;
+		file_table::file_id file_ = 0;
+		node* parent_ = nullptr;
+		source_span span_;
+	};
+
+	template <typename Impl>
+	struct node_impl : node {
+		node_impl() : node(kind_of<Impl>::value) {}
+
+		static constexpr auto id() -> node_kind {
+			return kind_of<Impl>::value;
+		}
+
+		static auto make() -> unique_ptr<Impl> {
+			return make_unique<Impl>();
+		}
+
+		auto clone() -> unique_ptr<Impl> {
+			return make_unique<Impl>();
+		}
 	};
 
 	template <typename Check>
@@ -75,29 +188,30 @@ namespace ast {
 	template <typename Target>
 	auto find_parent(node& n, function<bool(Target&)> predicate = [] (Target& _) { return true; }) -> Target* {
 		auto cur = n.parent();
-		auto target_id = Target::id();
+		constexpr auto target_id = Target::id();
 		while (cur && (cur->get_id() != target_id || !predicate(*static_cast<Target*>(cur)))) {
 			cur = cur->parent();
 		}
 		return static_cast<Target*>(cur);
 	}
 
-	// Sets the parent of the child nodes to point to the provided parent node
+	// Marks a node that was modified in place as changed, along with the path from it up to the root
+	// Nodes that are created or given a new parent are marked automatically
+	void mark_changed(node& n);
+
+	// Sets the parent of the child nodes to point to the provided parent node, marking the children that moved
     // U, T, and Rest... should all be pointer-like objects to ast::node
     template <typename U> void set_parent(U& parent) {}
     template <typename U, typename T, typename... Rest>
     void set_parent(U&& parent, T& child, Rest&... rest) {
-        child->parent() = static_cast<ast::node*>(&*parent);
+        auto new_parent = static_cast<ast::node*>(&*parent);
+        if (child->parent() != new_parent) {
+            child->parent() = new_parent;
+            mark_changed(*child);
+        }
         set_parent(parent, rest...);
     }
 
-    // Forward declarations of AST types
-    struct add; struct mul; struct sub; struct div; struct mod; struct exp;
-    struct and_op; struct or_op; struct comparison; struct negated;
-    struct for_in;
-    struct trait;
-    struct program;
-
 	template <typename Impl, typename T>
 	struct val_T : node_impl<Impl> {
 		T value;
@@ -108,7 +222,7 @@ namespace ast {
 			return std::move(result);
 		}
 
-		virtual auto clone() -> unique_ptr<Impl> {
+		auto clone() -> unique_ptr<Impl> {
 			return make(value);
 		}
 	};
@@ -141,9 +255,9 @@ namespace ast {
 
 	struct variable_decl : node_impl<variable_decl> {
 		unique_ptr<variable_type> type;
-		string name;
+		symbol name;
 
-		static auto make(unique_ptr<variable_type>&& type, string name) -> unique_ptr<variable_decl>;
+		static auto make(unique_ptr<variable_type>&& type, symbol name) -> unique_ptr<variable_decl>;
 		auto clone() -> unique_ptr<variable_decl>;
 	};
 
@@ -159,18 +273,25 @@ namespace ast {
 	struct this_unit {};
 	struct type_unit {};
 	struct identifier_unit {
-		identifier_unit(string identifier) : identifier(identifier) {}
-		string identifier;
+		identifier_unit(symbol identifier) : identifier(identifier) {}
+		symbol identifier;
 	};
 
 	using unit_object = variant<this_unit, type_unit, identifier_unit>;
 	struct field : node_impl<field> {
 		unit_object unit;
 		member_op_enum member_op;
-		string field_name;
+		symbol field_name;
 		bool is_rate;
 
-		static auto make(unit_object unit, member_op_enum member_op, string field_name, bool is_rate = false) -> unique_ptr<field>;
+		// What the field refers to, as found by the last run of resolve_symbols, which resolves every field that
+		//  changed since. Fields that have not been resolved yet search the AST instead
+		bool resolved = false;
+		for_in* resolved_loop = nullptr;
+		trait* resolved_trait = nullptr;
+		variable_decl* resolved_decl = nullptr;
+
+		static auto make(unit_object unit, member_op_enum member_op, symbol field_name, bool is_rate = false) -> unique_ptr<field>;
 		auto clone() -> unique_ptr<field>;
 		auto get_type() -> variable_type*;
 		// If the unit_object has type identifier_unit, returns the loop where the unit object was declared
@@ -303,13 +424,17 @@ namespace ast {
 	};
 
 	struct for_in : node_impl<for_in> {
-		string variable;
+		symbol variable;
 		double range;
 		unit_object range_unit;
-		vector<string> traits;
+		vector<symbol> traits;
 		unique_ptr<always_body> body;
 
-		static auto make(string variable, double range, unit_object range_unit, vector<string>& traits,
+		// The loop that range_unit refers to, as found by the last run of resolve_symbols
+		bool resolved = false;
+		for_in* resolved_loop = nullptr;
+
+		static auto make(symbol variable, double range, unit_object range_unit, vector<symbol>& traits,
 			unique_ptr<always_body>&& body) -> unique_ptr<for_in>;
 		auto clone() -> unique_ptr<for_in>;
 
@@ -328,20 +453,20 @@ namespace ast {
 	};
 
 	struct trait : node_impl<trait> {
-		string name;
+		symbol name;
 		unique_ptr<properties> props;
 		unique_ptr<always_body> body;
 
-		static auto make(string name, unique_ptr<properties>&& props, unique_ptr<always_body>&& body) -> unique_ptr<trait>;
+		static auto make(symbol name, unique_ptr<properties>&& props, unique_ptr<always_body>&& body) -> unique_ptr<trait>;
 		auto clone() -> unique_ptr<trait>;
-		auto get_property(string name) -> variable_decl*;
+		auto get_property(symbol name) -> variable_decl*;
 	};
 
 	struct trait_initializer : node_impl<trait_initializer> {
-		string name;
-		map<string, literal_value> initial_values;
+		symbol name;
+		map<symbol, literal_value> initial_values;
 
-		static auto make(string name, map<string, literal_value> initial_values) -> unique_ptr<trait_initializer>;
+		static auto make(symbol name, map<symbol, literal_value> initial_values) -> unique_ptr<trait_initializer>;
 		auto clone() -> unique_ptr<trait_initializer>;
 	};
 
@@ -362,7 +487,7 @@ namespace ast {
 		auto clone() -> unique_ptr<program>;
 
 		void insert_trait(unique_ptr<trait>&& trait);
-		auto get_trait(string name) -> trait*;
+		auto get_trait(symbol name) -> trait*;
 	};
 
 	template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "compiler.h"
+
+#include <string>
+#include <vector>
+#include <optional>
+
+// Compiles many maps in one process, several at a time, sharing the caches of parsed files and simplified traits,
+//  the Maude memo and the Maude processes between them
+class batch {
+public:
+	// The files of one map: the input followed by any files compiled along with it
+	using map_files = std::vector<std::string>;
+
+	struct options {
+		std::vector<map_files> maps;
+		std::string cache_dir;
+		bool maude_check = false;
+		// Number of threads used in total, which are shared out between the maps compiled at the same time
+		unsigned jobs = 1;
+		glc::pass_checks check_passes = glc::pass_checks::changed;
+	};
+
+	// Reads a manifest with one map per line, given as the paths of its files separated by spaces
+	// Empty lines and lines starting with # are ignored. Returns an empty option if the manifest cannot be read
+	static auto read_manifest(std::string const& filename) -> std::optional<std::vector<map_files>>;
+
+	batch(options opts);
+
+	// Compiles every map, printing the result of each as it finishes, followed by a summary of the whole run
+	// Returns true if every map compiled successfully
+	auto run() -> bool;
+
+private:
+	options opts;
+	glc::shared_maude maude;
+};
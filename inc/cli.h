@@ -74,5 +74,3 @@ private:
     std::unordered_map<std::string, bool> option_required;
     std::unordered_map<std::string, option_value> option_defaults;
 };
-
-extern cli_command cli_parser;
\ No newline at end of file
@@ -9,6 +9,8 @@
 // that applies to all units that leads to the same functionality
 class collapse_traits : public pass {
 public:
+	// resolve_symbols must be run immediately before, since fields are renamed through the declarations they were
+	//  resolved to, after declarations in other traits may already have been renamed
 	collapse_traits(pass_manager& pm);
 
 private:
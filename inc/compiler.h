@@ -0,0 +1,96 @@
+#pragma once
+
+#include "maude.h"
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <memory>
+
+// The compiler as a library, used by the glc command line and by programs that compile maps in-process
+// A compilation keeps all of its state to itself, so any number of compilations can run concurrently on different
+//  threads. They only share caches that are safe to use concurrently: files that have already been parsed, traits
+//  simplified in the cache directory, and the Maude memo if one is provided
+namespace glc {
+	// A file to compile, which is read from its path unless its contents are given
+	// The path is still used in error messages and to resolve the files it imports
+	// Given contents are shared with the compilation, which may keep them for as long as it caches the parsed file
+	struct source {
+		std::string path;
+		std::shared_ptr<std::string const> contents;
+	};
+
+	// How the program is checked after each pass that transforms it. The program is always checked in full after parsing
+	enum class pass_checks {
+		// Check the whole program again
+		full,
+		// Only check what the pass changed, and whatever depends on it
+		changed,
+		// Check what changed in about one in every eight compilations, which still catches a pass that produces invalid
+		//  programs when compiling many maps, without slowing down every compilation
+		// Which programs are checked depends only on their contents, so a program is checked every time or never
+		sampled,
+		// Only check in debug builds
+		debug
+	};
+
+	struct options {
+		// Files compiled together with the main source
+		std::vector<source> more_sources;
+		// Contents of other files, such as files imported by the sources, used instead of reading them from disk
+		std::vector<source> file_contents;
+		// Directory for results cached between compilations, or empty to disable caching
+		// Caching is disabled by default, so that embedding the compiler does not create files in the current directory
+		std::string cache_dir;
+		// Cross-check if statement merging against Maude (requires ./maude)
+		bool maude_check = false;
+		// Cache of Maude reductions shared with other compilations
+		// If there is none, each compilation that checks against Maude keeps its own, stored in the cache directory
+		maude_memo* memo = nullptr;
+		// Maude processes kept running between compilations, instead of starting new ones for each compilation
+		maude_pool* maude_processes = nullptr;
+		// Number of threads (and Maude processes) used to parse files and merge if statements
+		unsigned jobs = 1;
+		pass_checks check_passes = pass_checks::changed;
+	};
+
+	// The Maude memo and processes shared by every compilation of a command that compiles many times, such as glc serve,
+	//  watch and batch. Both are only set up if the compilations are checked against Maude
+	class shared_maude {
+	public:
+		shared_maude(std::string const& cache_dir, bool maude_check);
+
+		shared_maude(shared_maude const&) = delete;
+		auto operator=(shared_maude const&) -> shared_maude& = delete;
+
+		// Makes a compilation use the shared memo and processes
+		void share_with(options& opts);
+
+		std::optional<maude_memo> memo;
+		std::optional<maude_pool> processes;
+	};
+
+	// Returns the file in the cache directory that Maude reductions are memoized in, creating the directory if needed,
+	//  or an empty path if there is no cache directory
+	auto memo_file(std::string const& cache_dir) -> std::string;
+
+	struct result {
+		bool success = false;
+		// Error messages in the order they were reported, if compilation failed
+		std::vector<std::string> errors;
+
+		// Paths of the files in the program, which are known unless compilation failed before parsing
+		std::vector<std::string> files;
+		// Number of files in the program, and how many of them did not have to be parsed again
+		size_t num_files = 0;
+		size_t num_reused_files = 0;
+		// Number of traits whose simplified form was read from the cache, and number that were simplified
+		size_t num_reused_traits = 0;
+		size_t num_processed_traits = 0;
+		// Hits and misses of the Maude memo so far, if the compilation was checked against Maude
+		size_t memo_hits = 0;
+		size_t memo_misses = 0;
+	};
+
+	auto compile(source const& input, options const& opts) -> result;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "ast.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Interning table that gives every structurally equal arithmetic or logical expression the same id, so that
+//  expressions can be compared for equality by comparing ids and looked up without printing them
+// The id and structural hash of each interned node are cached, so the table must not outlive any
+//  modification of the expressions that were interned in it
+class expr_table {
+public:
+	using expr_id = uint32_t;
+
+	auto intern(ast::logical& n) -> expr_id;
+	auto intern(ast::arithmetic& n) -> expr_id;
+
+	// Structural hash of the expression with the provided id, which is stable across runs
+	auto hash(expr_id id) const -> uint64_t {
+		return entries[id].hash;
+	}
+
+	// Number of distinct expressions that have been interned
+	auto size() const -> size_t {
+		return entries.size();
+	}
+
+private:
+	enum class kind : uint8_t {
+		FIELD, INT, FLOAT, BOOL,
+		ADD, SUB, MUL, DIV, MOD, EXP,
+		EQ, NEQ, GT, LT, GTE, LTE,
+		AND, OR, NOT
+	};
+
+	struct entry {
+		kind k;
+		// Textual payload of leaves, such as the name of a field or the bits of a literal
+		std::string atom;
+		std::vector<expr_id> args;
+		uint64_t hash;
+
+		auto operator==(entry const& other) const -> bool {
+			return hash == other.hash && k == other.k && atom == other.atom && args == other.args;
+		}
+	};
+
+	struct entry_hash {
+		auto operator()(entry const& e) const -> size_t {
+			return static_cast<size_t>(e.hash);
+		}
+	};
+
+	auto intern(kind k, std::string atom, std::vector<expr_id> args) -> expr_id;
+	auto intern(ast::field& n) -> expr_id;
+	auto intern(ast::comparison& n) -> expr_id;
+
+	std::vector<entry> entries;
+	std::unordered_map<entry, expr_id, entry_hash> ids;
+	// Ids of nodes that have already been interned, so that interning a node a second time does not recurse
+	std::unordered_map<ast::node*, expr_id> node_ids;
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// Hashing helpers whose results are stable across runs and platforms, unlike std::hash,
+//  so that they can also be used to build keys for anything written to disk
+namespace hash {
+	constexpr uint64_t fnv_offset_basis = 14695981039346656037ULL;
+	constexpr uint64_t fnv_prime = 1099511628211ULL;
+
+	// 64 bit FNV-1a hash of the provided bytes, optionally continuing from a previous hash
+	inline auto fnv1a(std::string_view data, uint64_t seed = fnv_offset_basis) -> uint64_t {
+		auto result = seed;
+		for (auto c : data) {
+			result ^= static_cast<unsigned char>(c);
+			result *= fnv_prime;
+		}
+		return result;
+	}
+
+	// Mixes value into seed in an order-dependent way
+	inline auto combine(uint64_t seed, uint64_t value) -> uint64_t {
+		return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+	}
+};
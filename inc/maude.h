@@ -4,17 +4,122 @@
 #include <functional>
 #include <tuple>
 #include <optional>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <memory>
 
+#include <sys/types.h>
+
+// Cache of Maude reductions keyed by the reduced expression and a hash of the module it was reduced in
+// Entries can be kept in an append-only memo file, so that later runs start with the results of earlier ones
+// Lookups and insertions are thread safe, so one memo can be shared by several Maude processes
+class maude_memo {
+public:
+	using result = std::tuple<std::string, std::string>;
+
+	// Loads all entries for the module from the memo file at filename, which is created if it does not exist
+	// If filename is empty, the memo only lives in memory
+	maude_memo(std::string module, std::string filename = "");
+	~maude_memo();
+
+	maude_memo(maude_memo const&) = delete;
+	auto operator=(maude_memo const&) -> maude_memo& = delete;
+
+	auto lookup(std::string const& expr) -> std::optional<result>;
+	void insert(std::string const& expr, result const& value);
+
+	auto hits() const -> size_t {
+		return num_hits;
+	}
+
+	auto misses() const -> size_t {
+		return num_misses;
+	}
+
+private:
+	// Reads all complete records for the current module from the memo file
+	// Returns false if the file ends with an incomplete record
+	auto load(std::string const& filename) -> bool;
+
+	// Hash of the module contents in hex, which prefixes every record written by this memo
+	std::string module_key;
+	std::unordered_map<std::string, result> entries;
+	// Memo file opened for appending, or -1 if entries are not persisted
+	int fd = -1;
+	std::mutex lock;
+	size_t num_hits = 0;
+	size_t num_misses = 0;
+};
+
+// Long-lived Maude process that loads a module once and then answers any number of reductions
+// The process is started lazily on the first reduction, and restarted if it crashes or stops responding
 class maude {
 public:
-	maude(std::string module) : module(module) {}
+	// If a memo is provided, it is consulted before and updated after every reduction
+	maude(std::string module, maude_memo* memo = nullptr, std::chrono::milliseconds timeout = std::chrono::seconds(10))
+		: module(module), memo(memo), timeout(timeout) {}
+	~maude();
+
+	maude(maude const&) = delete;
+	auto operator=(maude const&) -> maude& = delete;
 
 	// Reduces the provided expression and returns a tuple containing the sort of the result and the result itself
 	// Returns an empty option on error
 	auto reduce(std::string expr) -> std::optional<std::tuple<std::string, std::string>>;
 
+	// Reduces all the provided expressions, sending them to Maude as a single pipelined batch
+	// The results are in the same order as the expressions, with an empty option for each one that failed
+	auto reduce_batch(std::vector<std::string> const& exprs) -> std::vector<std::optional<std::tuple<std::string, std::string>>>;
+
+	// Spawns ./maude with the module loaded and waits for it to become ready, returning false on failure
+	// Reductions call this themselves, so it only needs to be called to start Maude ahead of time
+	auto start() -> bool;
+
 private:
-	static auto run_command(std::string command, std::function<void(std::string)> callback) -> bool;
+	// Kills the Maude process if it is running
+	void stop();
+
+	// Sends commands to Maude and calls the callback with the index of the command and each line of its response
+	// Returns the number of commands that were answered, which is less than the number sent if Maude
+	//  could not be reached or did not respond in time
+	auto run_commands(std::vector<std::string> const& commands, std::function<void(size_t, std::string)> callback) -> size_t;
+	// Writes the request while reading output, until num_responses responses have been read or Maude fails
+	// The end of each response is detected by the prompt Maude prints when it is ready for the next command
+	auto exchange(std::string const& request, size_t num_responses, std::function<void(size_t, std::string)> callback) -> size_t;
+
+	std::string module;
+	maude_memo* memo;
+	std::chrono::milliseconds timeout;
+
+	pid_t pid = -1;
+	// Bidirectional channel connected to both stdin and stdout of the Maude process
+	int channel = -1;
+	// Output that has been read from Maude but not yet consumed
+	std::string pending;
+};
 
+// Maude processes that are kept running between compilations, so that later compilations do not have to wait for
+//  Maude to start and load the module again. Each process is used by one thread at a time, and given back afterwards
+class maude_pool {
+public:
+	// Processes started by the pool use the memo, if one is provided
+	maude_pool(std::string module, maude_memo* memo = nullptr) : module(module), memo(memo) {}
+
+	maude_pool(maude_pool const&) = delete;
+	auto operator=(maude_pool const&) -> maude_pool& = delete;
+
+	// Takes an idle process, or creates one if there are none
+	auto acquire() -> std::unique_ptr<maude>;
+	void release(std::unique_ptr<maude> session);
+
+	// Starts processes until the given number of them are idle
+	void start(size_t count);
+
+private:
 	std::string module;
+	maude_memo* memo;
+	std::mutex lock;
+	std::vector<std::unique_ptr<maude>> idle;
 };
@@ -2,11 +2,33 @@
 
 #include "ast.h"
 #include "pass_manager.h"
+#include "maude.h"
+#include "thread_pool.h"
 
 // Merges if statements such that the body of an if statement never directly contains another if statement
 class merge_ifs : public pass {
 public:
+	struct options {
+		// Conditions are compared using their normal forms, and this additionally asks Maude
+		//  to confirm each comparison, reporting any disagreements
+		bool maude_check = false;
+		// Cache of Maude reductions shared with other users of Maude, if any
+		maude_memo* memo = nullptr;
+		// Maude processes kept between compilations, which are used instead of starting new ones if provided
+		maude_pool* maude_processes = nullptr;
+		// Number of threads used to canonicalize conditions, and of Maude processes used to check them
+		// The output does not depend on the number of jobs
+		unsigned jobs = 1;
+		// Threads shared by several merges, which are used instead of starting new ones if provided
+		// Only one merge can use them at a time
+		thread_pool* workers = nullptr;
+	};
+
 	merge_ifs(pass_manager& pm);
+	merge_ifs(pass_manager& pm, options opts);
+
+	// Merges the if statements of a single trait of the program, leaving the rest of the program untouched
+	static void merge_trait(ast::program& program, ast::trait& trait, options const& opts);
 
 private:
 	ast::program& program;
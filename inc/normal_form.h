@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ast.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <functional>
+
+// Canonical form of a logical or arithmetic expression under the equations in lwg.maude
+// Expressions are rewritten bottom up with the same equations Maude would apply, and the operands of
+//  associative and commutative operators are flattened and sorted, so that two expressions that reduce to
+//  the same Maude term have equal normal forms. Comparing two normal forms is a hash comparison in the common case
+class normal_form {
+public:
+	static auto of(ast::logical& n) -> normal_form;
+	static auto of(ast::arithmetic& n) -> normal_form;
+
+	auto hash() const -> uint64_t;
+	auto operator==(normal_form const& other) const -> bool;
+	auto operator!=(normal_form const& other) const -> bool {
+		return !(*this == other);
+	}
+
+	// Prints the normal form using the operators of lwg.maude, intended for diagnostics
+	auto to_string() const -> std::string;
+
+private:
+	friend struct normal_form_builder;
+
+	enum class op : uint8_t {
+		// Fields and literals, which are opaque to the equations
+		ATOM,
+		ADD, MUL, NEG, INV, MOD, EXP,
+		EQS, LT, NOT, AND, OR
+	};
+
+	struct term;
+	using term_ptr = std::shared_ptr<term const>;
+	struct term {
+		op kind;
+		std::string atom;
+		std::vector<term_ptr> args;
+		uint64_t hash;
+	};
+
+	normal_form(term_ptr root) : root(root) {}
+
+	term_ptr root;
+};
+
+namespace std {
+	template <>
+	struct hash<normal_form> {
+		auto operator()(normal_form const& nf) const -> size_t {
+			return static_cast<size_t>(nf.hash());
+		}
+	};
+};
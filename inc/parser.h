@@ -5,10 +5,54 @@
 
 #include <string>
 #include <memory>
+#include <vector>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
 
+// Parses the input files, and every file they import, into a single program
+// Files are parsed concurrently, and the AST of each file is kept for the lifetime of the process, so that a file
+//  whose contents have not changed since it was last parsed is copied instead of being parsed again
+// Only the most recently used files are kept, up to 256 MiB of contents in total
 class parser : public pass {
 public:
+	struct options {
+		// Number of threads used to parse files
+		unsigned jobs = 1;
+		// Contents of files that are not read from disk, keyed by path, which are shared rather than copied
+		// A file given here can be imported by other files like any file on disk
+		std::unordered_map<std::string, std::shared_ptr<std::string const>> contents;
+	};
+
 	parser(pass_manager& pm, std::string input_file);
+	parser(pass_manager& pm, std::vector<std::string> input_files, options opts);
+
+	// Number of files that make up the program, and how many of them did not have to be parsed again
+	auto num_files() const -> size_t {
+		return files;
+	}
+
+	auto num_reused() const -> size_t {
+		return reused;
+	}
+
+	// Hash of the contents of every file of the program, which is the same whenever the same program is compiled
+	auto contents_hash() const -> uint64_t {
+		return program_hash;
+	}
+
+	// Paths of the files that make up the program, which are known even if some of them could not be parsed
+	auto file_paths() const -> std::vector<std::string> const& {
+		return paths;
+	}
 
 	std::unique_ptr<ast::program> program;
+
+private:
+	// The contents of every file of the program, which positions of its nodes are resolved against
+	std::vector<std::shared_ptr<std::string_view const>> contents;
+	std::vector<std::string> paths;
+	size_t files = 0;
+	size_t reused = 0;
+	uint64_t program_hash = 0;
 };
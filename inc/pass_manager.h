@@ -2,9 +2,8 @@
 
 #include "ast.h"
 
-#include <map>
+#include <atomic>
 #include <string>
-#include <typeinfo>
 #include <functional>
 #include <cassert>
 #include <vector>
@@ -15,16 +14,29 @@ public:
 	virtual ~pass() {}
 };
 
+// Returns a small index that is unique to the provided pass type, assigned the first time it is requested
+// Indices are dense, so that per-pass state can be stored in vectors instead of maps
+inline auto next_pass_index() -> size_t {
+	static std::atomic<size_t> counter = 0;
+	return counter++;
+}
+
+template <typename Pass>
+auto pass_index() -> size_t {
+	static auto const index = next_pass_index();
+	return index;
+}
+
 class pass_manager {
 public:
 	// Returns the pass in case of success, and nullptr in case of an error
 	template <typename Pass, typename... Params>
 	Pass *run_pass(Params... args) {
-		size_t id = typeid(Pass).hash_code();
+		auto id = pass_index<Pass>();
 
-		passes[id] = std::unique_ptr<pass>(std::make_unique<Pass>(*this, args...).release());
+		slot(passes, id) = std::unique_ptr<pass>(std::make_unique<Pass>(*this, args...).release());
 
-		if (errors.find(id) == errors.end()) {
+		if (slot(errors, id).empty()) {
 			return static_cast<Pass*>(passes[id].get());
 		} else {
 		    throw get_errors<Pass>();
@@ -33,28 +45,37 @@ public:
 
 	template <typename Pass>
 	Pass *get_pass() {
-		size_t id = typeid(Pass).hash_code();
-		assert(passes.find(id) != passes.end());
+		auto id = pass_index<Pass>();
+		assert(id < passes.size() && passes[id]);
 		return static_cast<Pass*>(passes[id].get());
 	}
 
 	template <typename Pass>
 	void error(ast::node& n, std::string const& err) {
-		errors[typeid(Pass).hash_code()].push_back(
+		get_errors<Pass>().push_back(
 			n.filename() + ":" + std::to_string(n.line()) + ":" + std::to_string(n.col()) + ": " + err);
 	}
 
 	template <typename Pass>
 	void error(std::string const& err) {
-		errors[typeid(Pass).hash_code()].push_back(err);
+		get_errors<Pass>().push_back(err);
 	}
 
 	template <typename Pass>
 	auto get_errors() -> std::vector<std::string>& {
-		return errors[typeid(Pass).hash_code()];
+		return slot(errors, pass_index<Pass>());
 	}
 
 private:
-	std::map<size_t, std::vector<std::string>> errors;
-	std::map<size_t, std::unique_ptr<pass>> passes;
+	// Returns the element at index, growing the vector if it is not that large yet
+	template <typename T>
+	static auto slot(std::vector<T>& v, size_t index) -> T& {
+		if (index >= v.size()) {
+			v.resize(index + 1);
+		}
+		return v[index];
+	}
+
+	std::vector<std::vector<std::string>> errors;
+	std::vector<std::unique_ptr<pass>> passes;
 };
@@ -8459,6 +8459,7 @@ namespace TAO_PEGTL_NAMESPACE
 
 #include <cstdint>
 #include <cstdlib>
+#include <limits>
 
 #include <type_traits>
 
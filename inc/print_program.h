@@ -4,8 +4,73 @@
 #include "visitor.h"
 
 #include <string>
+#include <string_view>
+#include <ostream>
+#include <charconv>
+#include <cstdio>
 #include <type_traits>
 
+// Destination of printed text, which either appends to a string or writes to a stream
+// Every token is written once, directly to its destination, so printing is linear in the size of the output
+class print_sink {
+public:
+	print_sink(std::string& buffer) : buffer(&buffer) {}
+	print_sink(std::ostream& stream) : stream(&stream) {}
+
+	auto operator<<(std::string_view text) -> print_sink& {
+		if (buffer) {
+			buffer->append(text);
+		} else {
+			stream->write(text.data(), text.size());
+		}
+		return *this;
+	}
+
+	auto operator<<(char const* text) -> print_sink& {
+		return *this << std::string_view(text);
+	}
+
+	auto operator<<(std::string const& text) -> print_sink& {
+		return *this << std::string_view(text);
+	}
+
+	auto operator<<(ast::symbol name) -> print_sink& {
+		return *this << std::string_view(name.str());
+	}
+
+	auto operator<<(char c) -> print_sink& {
+		return *this << std::string_view(&c, 1);
+	}
+
+	// Numbers are written in the same format as std::to_string, without building a string for them
+	auto operator<<(long value) -> print_sink& {
+		char digits[24];
+		auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+		return *this << std::string_view(digits, end - digits);
+	}
+
+	auto operator<<(double value) -> print_sink& {
+		char digits[512];
+		auto length = std::snprintf(digits, sizeof(digits), "%f", value);
+		return *this << std::string_view(digits, length);
+	}
+
+	void indent(size_t depth) {
+		for (size_t i = 0; i < depth; i++) {
+			*this << '\t';
+		}
+	}
+
+private:
+	std::string* buffer = nullptr;
+	std::ostream* stream = nullptr;
+};
+
+// Prints the program, or any node in it, as LWG source
+// Custom printers replace how some kinds of nodes are printed, such as maude_printer, which prints expressions in
+//  the syntax of lwg.maude. A custom printer has an operator() taking the print_program, a print_sink and the node,
+//  and prints children of the node through write_node so that they are also printed with the custom printer
+// Custom printers may instead take only the print_program and the node and return the text for the node
 class print_program {
 public:
 	print_program(ast::program& program) : program(program) {}
@@ -26,7 +91,19 @@ public:
 
 	template <typename T, typename CustomPrinter>
 	auto get_output_for_node(T& v, CustomPrinter*** cp = nullptr) -> std::string {
-		return print<CustomPrinter>(v);
+		auto output = std::string();
+		auto out = print_sink(output);
+		write_node<T, CustomPrinter>(v, out);
+		return output;
+	}
+
+	void write(print_sink out) {
+		write_node<ast::program, void>(program, out);
+	}
+
+	template <typename T, typename CustomPrinter = void>
+	void write_node(T& v, print_sink out) {
+		print<CustomPrinter>(out, v);
 	}
 
 private:
@@ -34,287 +111,294 @@ private:
 	struct has_printer : std::false_type {};
 
 	template <typename T, typename AstNode>
-	struct has_printer<T, AstNode,
+	struct has_printer<T, AstNode, std::void_t<decltype(
+		std::declval<T>()(std::declval<print_program&>(), std::declval<print_sink&>(), std::declval<AstNode&>()))>>
+		: std::true_type {};
+
+	template <typename T, typename AstNode, typename = void>
+	struct has_string_printer : std::false_type {};
+
+	template <typename T, typename AstNode>
+	struct has_string_printer<T, AstNode,
 		std::void_t<decltype(std::declval<T>()(std::declval<print_program&>(), std::declval<AstNode&>()))>> : std::true_type {};
 
 	template <typename CustomPrinter, typename T, typename... Args>
-	auto print(T& v, Args... args) -> std::string {
+	void print(print_sink& out, T& v, Args... args) {
 		if constexpr (std::is_same<CustomPrinter, void>::value) {
-			return print_impl<CustomPrinter>(v, args...);
+			print_impl<CustomPrinter>(out, v, args...);
+		} else if constexpr (has_printer<CustomPrinter, T>::value) {
+			CustomPrinter()(*this, out, v);
+		} else if constexpr (has_string_printer<CustomPrinter, T>::value) {
+			out << CustomPrinter()(*this, v);
 		} else {
-			if constexpr (has_printer<CustomPrinter, T>::value) {
-				return CustomPrinter()(*this, v);
-			} else {
-				return print_impl<CustomPrinter>(v, args...);
-			}
+			print_impl<CustomPrinter>(out, v, args...);
 		}
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::val_bool& v) -> std::string {
-		return v.value ? "true" : "false";
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::val_bool& v) {
+		out << (v.value ? "true" : "false");
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::val_float& v) -> std::string {
-		return std::to_string(v.value);
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::val_float& v) {
+		out << v.value;
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::val_int& v) -> std::string {
-		return std::to_string(v.value);
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::val_int& v) {
+		out << v.value;
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::variable_type& v) -> std::string {
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::variable_type& v) {
 		switch (v.type) {
 			case ast::type_enum::BOOL:
-				return "bool";
+				out << "bool";
+				break;
 			case ast::type_enum::INT:
-				return "int<" + std::to_string(v.min) + ", " + std::to_string(v.max) + ">";
+				out << "int<" << v.min << ", " << v.max << ">";
+				break;
 			case ast::type_enum::FLOAT:
-				return "float";
+				out << "float";
+				break;
 			default:
 				assert(false);
 		}
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::variable_decl& v) -> std::string {
-		return v.name + " : " + print<CustomPrinter>(*v.type);
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::variable_decl& v) {
+		out << v.name << " : ";
+		print<CustomPrinter>(out, *v.type);
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::properties& v) -> std::string {
-		auto output = std::string("\tproperties {\n");
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::properties& v) {
+		out << "\tproperties {\n";
 		for (size_t i = 0; i < v.variable_declarations.size(); i++) {
-			output += "\t\t" + print<CustomPrinter>(*v.variable_declarations[i]);
+			out << "\t\t";
+			print<CustomPrinter>(out, *v.variable_declarations[i]);
 			if (i < v.variable_declarations.size() - 1) {
-				output += ",";
+				out << ",";
 			}
-			output += "\n";
+			out << "\n";
 		}
-		output += "\t}\n";
-		return output;
+		out << "\t}\n";
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::field& v) -> std::string {
-		auto output = std::string();
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::field& v) {
 		std::visit(ast::overloaded {
-			[&] (ast::this_unit _) { output = "this"; },
-			[&] (ast::type_unit _) { output = "type"; },
-			[&] (ast::identifier_unit u) { output = u.identifier; },
+			[&] (ast::this_unit _) { out << "this"; },
+			[&] (ast::type_unit _) { out << "type"; },
+			[&] (ast::identifier_unit u) { out << u.identifier; },
 		}, v.unit);
 		switch (v.member_op) {
-			case ast::member_op_enum::BUILTIN: output += "::"; break;
-			case ast::member_op_enum::CUSTOM: output += "."; break;
-			case ast::member_op_enum::LANGUAGE: output += "->"; break;
+			case ast::member_op_enum::BUILTIN: out << "::"; break;
+			case ast::member_op_enum::CUSTOM: out << "."; break;
+			case ast::member_op_enum::LANGUAGE: out << "->"; break;
 			default: assert(false);
 		}
-		output += v.field_name;
-		return output;
+		out << v.field_name;
 	}
 
 	template <typename OpNode, char Op, typename CustomPrinter>
-	auto print_binary_op(OpNode& v) -> std::string {
-		auto output = "(" + print<CustomPrinter>(*v.expr_1);
-		output += " " + std::string(1, Op) + " ";
-		output += print<CustomPrinter>(*v.expr_2) + ")";
-		return output;
+	void print_binary_op(print_sink& out, OpNode& v) {
+		out << "(";
+		print<CustomPrinter>(out, *v.expr_1);
+		out << " " << Op << " ";
+		print<CustomPrinter>(out, *v.expr_2);
+		out << ")";
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::add& v) -> std::string {
-		return print_binary_op<ast::add, '+', CustomPrinter>(v);
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::add& v) {
+		print_binary_op<ast::add, '+', CustomPrinter>(out, v);
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::mul& v) -> std::string {
-		return print_binary_op<ast::mul, '*', CustomPrinter>(v);
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::mul& v) {
+		print_binary_op<ast::mul, '*', CustomPrinter>(out, v);
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::sub& v) -> std::string {
-		return print_binary_op<ast::sub, '-', CustomPrinter>(v);
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::sub& v) {
+		print_binary_op<ast::sub, '-', CustomPrinter>(out, v);
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::div& v) -> std::string {
-		return print_binary_op<ast::div, '/', CustomPrinter>(v);
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::div& v) {
+		print_binary_op<ast::div, '/', CustomPrinter>(out, v);
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::mod& v) -> std::string {
-		return print_binary_op<ast::mod, '%', CustomPrinter>(v);
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::mod& v) {
+		print_binary_op<ast::mod, '%', CustomPrinter>(out, v);
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::exp& v) -> std::string {
-		return print_binary_op<ast::exp, '^', CustomPrinter>(v);
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::exp& v) {
+		print_binary_op<ast::exp, '^', CustomPrinter>(out, v);
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::arithmetic_value& v) -> std::string {
-		auto output = std::string();
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::arithmetic_value& v) {
 		std::visit(ast::overloaded {
-			[&] (std::unique_ptr<ast::field>& val) { output = print<CustomPrinter>(*val); },
-			[&] (long val) { output = std::to_string(val); },
-			[&] (double val) { output = std::to_string(val); }
+			[&] (std::unique_ptr<ast::field>& val) { print<CustomPrinter>(out, *val); },
+			[&] (long val) { out << val; },
+			[&] (double val) { out << val; }
 		}, v.value);
-		return output;
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::arithmetic& v) -> std::string {
-		auto output = std::string("(");
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::arithmetic& v) {
+		out << "(";
 		std::visit([&] (auto& val) {
-			output += print<CustomPrinter>(*val);
+			print<CustomPrinter>(out, *val);
 		}, v.expr);
-		output += ")";
-		return output;
+		out << ")";
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::comparison& v) -> std::string {
-		auto output = std::string();
-		output += print<CustomPrinter>(*v.lhs);
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::comparison& v) {
+		print<CustomPrinter>(out, *v.lhs);
 		switch (v.comparison_type) {
-			case ast::comparison_enum::EQ: output += " == "; break;
-			case ast::comparison_enum::NEQ: output += " != "; break;
-			case ast::comparison_enum::GT: output += " > "; break;
-			case ast::comparison_enum::LT: output += " < "; break;
-			case ast::comparison_enum::GTE: output += " >= "; break;
-			case ast::comparison_enum::LTE: output += " <= "; break;
+			case ast::comparison_enum::EQ: out << " == "; break;
+			case ast::comparison_enum::NEQ: out << " != "; break;
+			case ast::comparison_enum::GT: out << " > "; break;
+			case ast::comparison_enum::LT: out << " < "; break;
+			case ast::comparison_enum::GTE: out << " >= "; break;
+			case ast::comparison_enum::LTE: out << " <= "; break;
 			default: assert(false);
 		}
-		output += "(" + print<CustomPrinter>(*v.rhs) + ")";
-		return output;
+		out << "(";
+		print<CustomPrinter>(out, *v.rhs);
+		out << ")";
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::and_op& v) -> std::string {
-		return "(" + print<CustomPrinter>(*v.expr_1) + " and " + print<CustomPrinter>(*v.expr_2) + ")";
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::and_op& v) {
+		out << "(";
+		print<CustomPrinter>(out, *v.expr_1);
+		out << " and ";
+		print<CustomPrinter>(out, *v.expr_2);
+		out << ")";
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::or_op& v) -> std::string {
-		return "(" + print<CustomPrinter>(*v.expr_1) + " or " + print<CustomPrinter>(*v.expr_2) + ")";
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::or_op& v) {
+		out << "(";
+		print<CustomPrinter>(out, *v.expr_1);
+		out << " or ";
+		print<CustomPrinter>(out, *v.expr_2);
+		out << ")";
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::negated& v) -> std::string {
-		return "not " + print<CustomPrinter>(*v.expr);
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::negated& v) {
+		out << "not ";
+		print<CustomPrinter>(out, *v.expr);
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::logical& v) -> std::string {
-		auto output = std::string("(");
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::logical& v) {
+		out << "(";
 		std::visit([&] (auto& val) {
-			output += print<CustomPrinter>(*val);
+			print<CustomPrinter>(out, *val);
 		}, v.expr);
-		output += ")";
-		return output;
+		out << ")";
 	}
 
-	auto print_indent(size_t indent = 0) -> std::string {
-		auto output = std::string();
-		for (size_t i = 0; i < indent; i++) {
-			output += "\t";
-		}
-		return output;
-	}
-
-	template <typename CustomPrinter> auto print_impl(ast::assignment& v, size_t indent = 0) -> std::string {
-		auto output = print_indent(indent) + print<CustomPrinter>(*v.lhs) + " = ";
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::assignment& v, size_t indent = 0) {
+		out.indent(indent);
+		print<CustomPrinter>(out, *v.lhs);
+		out << " = ";
 		std::visit([&] (auto& rhs) {
-			output += print<CustomPrinter>(*rhs);
+			print<CustomPrinter>(out, *rhs);
 		}, v.rhs);
-		output += ";\n";
-		return output;
+		out << ";\n";
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::continuous_if& v, size_t indent = 0) -> std::string {
-		auto output = print_indent(indent) + "if " + print<CustomPrinter>(*v.condition) + " {\n";
-		output += print<CustomPrinter>(*v.body, indent + 1);
-		output += print_indent(indent) + "}\n";
-		return output;
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::continuous_if& v, size_t indent = 0) {
+		out.indent(indent);
+		out << "if ";
+		print<CustomPrinter>(out, *v.condition);
+		out << " {\n";
+		print<CustomPrinter>(out, *v.body, indent + 1);
+		out.indent(indent);
+		out << "}\n";
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::transition_if& v, size_t indent = 0) -> std::string {
-		auto output = print_indent(indent) + "if becomes " + print<CustomPrinter>(*v.condition) + " {\n";
-		output += print<CustomPrinter>(*v.body, indent + 1);
-		output += print_indent(indent) + "}\n";
-		return output;
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::transition_if& v, size_t indent = 0) {
+		out.indent(indent);
+		out << "if becomes ";
+		print<CustomPrinter>(out, *v.condition);
+		out << " {\n";
+		print<CustomPrinter>(out, *v.body, indent + 1);
+		out.indent(indent);
+		out << "}\n";
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::for_in& v, size_t indent = 0) -> std::string {
-		auto output = print_indent(indent) + "for " + v.variable + " in range " + std::to_string(v.range) +
-			" of ";
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::for_in& v, size_t indent = 0) {
+		out.indent(indent);
+		out << "for " << v.variable << " in range " << v.range << " of ";
 		std::visit(ast::overloaded {
-			[&] (ast::this_unit _) { output += "this"; },
-			[&] (ast::type_unit _) { output += "type"; },
-			[&] (ast::identifier_unit u) { output += u.identifier; },
+			[&] (ast::this_unit _) { out << "this"; },
+			[&] (ast::type_unit _) { out << "type"; },
+			[&] (ast::identifier_unit u) { out << u.identifier; },
 		}, v.range_unit);
 
 		if (!v.traits.empty()) {
-			output += " with trait ";
+			out << " with trait ";
 			for (size_t i = 0; i < v.traits.size(); i++) {
-				output += v.traits[i];
+				out << v.traits[i];
 				if (i < v.traits.size() - 1) {
-					output += ", ";
+					out << ", ";
 				}
 			}
 		}
-		output += " {\n";
-		output += print<CustomPrinter>(*v.body, indent + 1);
-		output += print_indent(indent) + "}\n";
-		return output;
+		out << " {\n";
+		print<CustomPrinter>(out, *v.body, indent + 1);
+		out.indent(indent);
+		out << "}\n";
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::always_body& v, size_t indent = 0) -> std::string {
-		auto output = std::string();
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::always_body& v, size_t indent = 0) {
 		for (auto& expr : v.exprs) {
 			std::visit([&] (auto& n) {
-				output += print<CustomPrinter>(*n, indent);
+				print<CustomPrinter>(out, *n, indent);
 			}, expr);
 		}
-		return output;
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::trait& v) -> std::string {
-		auto output = "trait " + v.name + " {\n";
-		output += print<CustomPrinter>(*v.props);
-		output += "\n\talways {\n" + print<CustomPrinter>(*v.body, 2);
-		output += "\t}\n";
-		output += "}\n\n";
-		return output;
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::trait& v) {
+		out << "trait " << v.name << " {\n";
+		print<CustomPrinter>(out, *v.props);
+		out << "\n\talways {\n";
+		print<CustomPrinter>(out, *v.body, 2);
+		out << "\t}\n";
+		out << "}\n\n";
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::trait_initializer& v) -> std::string {
-		auto output = v.name;
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::trait_initializer& v) {
+		out << v.name;
 		if (!v.initial_values.empty()) {
-			output += "(";
+			out << "(";
 			for (auto it = v.initial_values.begin(); it != v.initial_values.end();) {
 				auto& [property, value] = *it;
 
-				output += property + " = ";
+				out << property << " = ";
 				std::visit(ast::overloaded {
-					[&] (bool val) { output += val ? "true" : "false"; },
-					[&] (double val) { output += std::to_string(val); },
-					[&] (long val) { output += std::to_string(val); }
+					[&] (bool val) { out << (val ? "true" : "false"); },
+					[&] (double val) { out << val; },
+					[&] (long val) { out << val; }
 				}, value);
 
 				if (++it != v.initial_values.end()) {
-					output += ", ";
+					out << ", ";
 				}
 			}
-			output += ")";
+			out << ")";
 		}
-		return output;
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::unit_traits& v) -> std::string {
-		auto output = "unit " + v.name + " : ";
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::unit_traits& v) {
+		out << "unit " << v.name << " : ";
 		for (auto& trait_init : v.traits) {
-			output += print<CustomPrinter>(*trait_init);
+			print<CustomPrinter>(out, *trait_init);
 		}
-		output += ";\n";
-		return output;
+		out << ";\n";
 	}
 
-	template <typename CustomPrinter> auto print_impl(ast::program& v) -> std::string {
-		auto output = std::string();
-
+	template <typename CustomPrinter> void print_impl(print_sink& out, ast::program& v) {
 		for (auto& trait : v.traits) {
-			output += print<CustomPrinter>(*trait);
+			print<CustomPrinter>(out, *trait);
 		}
 
 		for (auto& unit_trait : v.all_unit_traits) {
-			output += print<CustomPrinter>(*unit_trait);
+			print<CustomPrinter>(out, *unit_trait);
 		}
-
-		return output;
 	}
 
 	ast::program& program;
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "ast.h"
+#include "pass_manager.h"
+
+// Resolves every field to the loop, trait and property declaration it refers to, and every loop over the units
+//  of another loop to that loop, so that looking them up afterwards does not have to search the AST
+// Only the parts of the program that changed since the last check are resolved again, along with everything that
+//  refers to a trait that changed, and those are marked as changed for the semantic checker to check
+class resolve_symbols : public pass {
+public:
+	resolve_symbols(pass_manager& pm);
+
+private:
+	ast::program& program;
+};
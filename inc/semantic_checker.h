@@ -5,9 +5,19 @@
 
 class semantic_checker : public pass {
 public:
+	enum class mode {
+		// Checks the whole program
+		full,
+		// Only checks the parts of the program that changed since it was last checked, which passes mark as they
+		//  change them, and resolve_symbols extends to everything that refers to a trait that changed
+		// Checking clears the marks again
+		changed
+	};
+
 	semantic_checker(pass_manager& pm);
+	semantic_checker(pass_manager& pm, mode check_mode);
 
 private:
 	pass_manager& pm;
 	ast::program& program;
-};
\ No newline at end of file
+};
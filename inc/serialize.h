@@ -0,0 +1,18 @@
+#pragma once
+
+#include "ast.h"
+
+#include <string>
+#include <string_view>
+#include <memory>
+
+namespace ast {
+	// Converts a trait into a compact textual form that can be read back with deserialize_trait
+	// Offsets are stored relative to the offset of the trait, and the filename is not stored, so that
+	//  the same trait serializes identically wherever it appears in the input
+	auto serialize(trait& t) -> string;
+
+	// Reconstructs a trait from the output of serialize, placing it at the offset and in the file of the provided
+	//  trait. Returns nullptr if the input is malformed
+	auto deserialize_trait(std::string_view data, trait& location) -> unique_ptr<trait>;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "compiler.h"
+
+#include <string>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+
+// Compiles requests for as long as it runs, keeping what would otherwise be set up again by every run of glc:
+//  files that have already been parsed, the grammar analysis, the Maude memo, and running Maude processes
+// Requests are read either from stdin or from clients of a Unix socket, one compilation per request. Each request
+//  is a line of words separated by spaces, so paths cannot contain spaces:
+//   source <path> <length>      followed by length bytes, which are compiled as the contents of the path by the
+//                               next compile request instead of reading the file. Sources are refused once
+//                               those for one compile request would be over 256 MiB in total
+//   compile <path> [<path>...]  compiles the files, the first being the input and the rest compiled along with it
+//   quit                        ends the session
+// Every compile request is answered with a line "error <message>" for each error, followed by
+//  "done ok <milliseconds>" or "done failed <milliseconds>"
+// Debug builds print every pass to stdout, so they can only be used with a socket
+// Parsed files are kept for as long as the server runs, up to 256 MiB of contents in total, after which the least
+//  recently used are dropped. Every distinct name seen is interned for the lifetime of the process, so the symbol
+//  table grows with the names of every program compiled, although far more slowly than the files themselves
+class server {
+public:
+	struct options {
+		// Unix socket to listen on, or empty to read requests from stdin and answer on stdout
+		std::string socket_path;
+		std::string cache_dir;
+		bool maude_check = false;
+		unsigned jobs = 1;
+		glc::pass_checks check_passes = glc::pass_checks::changed;
+	};
+
+	server(options opts);
+
+	// Serves requests until stdin ends or a quit request is read from it, or forever when listening on a socket,
+	//  where each client is served by its own thread. Returns false if the socket could not be opened, or once every
+	//  client has been ended after the socket stopped accepting them, removing the socket
+	// A socket already at the path is replaced, but any other kind of file makes opening the socket fail
+	auto run() -> bool;
+
+private:
+	// Serves the requests read from in until it ends or a quit request is read
+	void serve(int in, int out);
+
+	options opts;
+	glc::shared_maude maude;
+
+	// Sockets of the clients currently being served
+	std::mutex clients_lock;
+	std::condition_variable clients_done;
+	std::set<int> clients;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ast.h"
+#include "pass_manager.h"
+#include "merge_ifs.h"
+
+#include <string>
+
+// Runs simplify_transition_ifs and merge_ifs on each trait separately, before the traits are collapsed
+// If a cache directory is provided, the result for each trait is stored there, and traits that have not changed
+//  since an earlier compilation by the same compiler are read back instead of being processed again
+// Only the 1024 most recently used results are kept, and older ones are removed whenever new ones are stored
+class simplify_traits : public pass {
+public:
+	struct options {
+		// Directory in which results are cached, or empty to disable caching
+		std::string cache_dir;
+		merge_ifs::options merge_opts;
+	};
+
+	simplify_traits(pass_manager& pm, options opts);
+
+	// Number of traits whose result was read from the cache, and number that were processed
+	auto num_reused() const -> size_t {
+		return reused;
+	}
+
+	auto num_processed() const -> size_t {
+		return processed;
+	}
+
+private:
+	ast::program& program;
+	size_t reused = 0;
+	size_t processed = 0;
+};
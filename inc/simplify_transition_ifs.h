@@ -8,6 +8,9 @@ class simplify_transition_ifs : public pass {
 public:
 	simplify_transition_ifs(pass_manager& pm);
 
+	// Converts the transition ifs of a single trait, independently of the rest of the program
+	static void simplify_trait(ast::trait& trait);
+
 private:
 	ast::program& program;
 };
\ No newline at end of file
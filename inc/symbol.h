@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+
+namespace ast {
+	// A name interned in a table shared by the whole process, so that every distinct name is stored once and symbols
+	//  are compared and hashed by their 32-bit ids instead of by their characters
+	// Names the compiler generates from other names are composed from their symbols, and only built as strings
+	//  the first time each combination is needed
+	// Symbols order by their names, so containers ordered by symbol iterate in the same order as by string
+	// Names are never removed, so a process that compiles many programs, such as glc serve, keeps every name any of
+	//  them used, including generated ones. This is accepted, since names are small next to the files they come from
+	class symbol {
+	public:
+		// The empty name
+		symbol();
+		symbol(std::string_view name);
+		symbol(std::string const& name) : symbol(std::string_view(name)) {}
+		symbol(char const* name) : symbol(std::string_view(name)) {}
+
+		// Returns the symbol for prefix~name, which is the form of the names generated for variables
+		static auto compose(symbol prefix, symbol name) -> symbol;
+
+		auto str() const -> std::string const& {
+			return entry_->name;
+		}
+
+		operator std::string const&() const {
+			return entry_->name;
+		}
+
+		auto id() const -> uint32_t {
+			return entry_->id;
+		}
+
+		auto empty() const -> bool {
+			return entry_->name.empty();
+		}
+
+		friend auto operator==(symbol a, symbol b) -> bool {
+			return a.entry_ == b.entry_;
+		}
+
+		friend auto operator!=(symbol a, symbol b) -> bool {
+			return a.entry_ != b.entry_;
+		}
+
+		friend auto operator<(symbol a, symbol b) -> bool {
+			return a.entry_ != b.entry_ && a.entry_->name < b.entry_->name;
+		}
+
+		struct entry {
+			std::string name;
+			uint32_t id;
+		};
+
+	private:
+		// Entries are never removed from the table, so symbols can refer to them without locking it
+		entry const* entry_;
+	};
+
+	inline auto operator+(std::string const& lhs, symbol rhs) -> std::string {
+		return lhs + rhs.str();
+	}
+
+	inline auto operator+(char const* lhs, symbol rhs) -> std::string {
+		return lhs + rhs.str();
+	}
+
+	inline auto operator+(symbol lhs, std::string const& rhs) -> std::string {
+		return lhs.str() + rhs;
+	}
+
+	inline auto operator+(symbol lhs, char const* rhs) -> std::string {
+		return lhs.str() + rhs;
+	}
+
+	inline auto operator<<(std::ostream& out, symbol s) -> std::ostream& {
+		return out << s.str();
+	}
+}
+
+template <>
+struct std::hash<ast::symbol> {
+	auto operator()(ast::symbol s) const -> size_t {
+		return s.id();
+	}
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Fixed set of worker threads that run submitted tasks in the order they were submitted
+// Each task is given the index of the worker running it, so that tasks can use per-worker state without locking
+class thread_pool {
+public:
+	using task = std::function<void(unsigned)>;
+
+	// A pool with 0 threads is treated as a pool with 1 thread
+	thread_pool(unsigned num_threads);
+	~thread_pool();
+
+	thread_pool(thread_pool const&) = delete;
+	auto operator=(thread_pool const&) -> thread_pool& = delete;
+
+	auto size() const -> unsigned {
+		return workers.size();
+	}
+
+	void submit(task t);
+	// Blocks until every task that has been submitted has finished running
+	void wait();
+
+private:
+	void run(unsigned worker);
+
+	std::vector<std::thread> workers;
+	std::deque<task> tasks;
+	// Number of tasks that have been taken from the queue but have not finished yet
+	unsigned running = 0;
+	bool stopping = false;
+
+	std::mutex lock;
+	std::condition_variable task_available;
+	std::condition_variable tasks_done;
+};
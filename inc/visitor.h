@@ -5,6 +5,8 @@
 #include <type_traits>
 #include <cassert>
 #include <memory>
+#include <tuple>
+#include <array>
 
 // Struct whose () operator takes a root AST node and a visitor, and calls the visit methods
 // in the provided Visitor on the tree formed by the root AstNode in reverse topological order
@@ -17,16 +19,166 @@ struct has_visitor : std::false_type {};
 template <typename T, typename AstNode>
 struct has_visitor<T, AstNode, std::void_t<decltype(std::declval<T>()(std::declval<AstNode&>()))>> : std::true_type {};
 
+// Visitors may also have an enter method, which is called before visiting a node and its children, and returns
+//  whether to visit them at all
+template <typename T, typename AstNode, typename = void>
+struct has_enter : std::false_type {};
+
+template <typename T, typename AstNode>
+struct has_enter<T, AstNode, std::void_t<decltype(std::declval<T>().enter(std::declval<AstNode&>()))>> : std::true_type {};
+
+template <typename... Types>
+struct type_list {};
+
+// The types of the nodes that visit<> descends into from a node of type AstNode, which must be kept in sync with
+//  the visit_children of each specialization of visit below
+template <typename AstNode>
+struct child_types { using type = type_list<>; };
+
+template <> struct child_types<ast::program> { using type = type_list<ast::trait, ast::unit_traits>; };
+template <> struct child_types<ast::trait> { using type = type_list<ast::properties, ast::always_body>; };
+template <> struct child_types<ast::unit_traits> { using type = type_list<ast::trait_initializer>; };
+template <> struct child_types<ast::properties> { using type = type_list<ast::variable_decl>; };
+template <> struct child_types<ast::variable_decl> { using type = type_list<ast::variable_type>; };
+template <> struct child_types<ast::always_body> {
+	using type = type_list<ast::assignment, ast::continuous_if, ast::transition_if, ast::for_in>;
+};
+template <> struct child_types<ast::assignment> { using type = type_list<ast::field, ast::arithmetic, ast::logical>; };
+template <> struct child_types<ast::continuous_if> { using type = type_list<ast::logical, ast::always_body>; };
+template <> struct child_types<ast::transition_if> { using type = type_list<ast::logical, ast::always_body>; };
+template <> struct child_types<ast::for_in> { using type = type_list<ast::always_body>; };
+template <> struct child_types<ast::logical> {
+	using type = type_list<ast::and_op, ast::or_op, ast::field, ast::val_bool, ast::comparison, ast::negated>;
+};
+template <> struct child_types<ast::and_op> { using type = type_list<ast::logical>; };
+template <> struct child_types<ast::or_op> { using type = type_list<ast::logical>; };
+template <> struct child_types<ast::negated> { using type = type_list<ast::logical>; };
+template <> struct child_types<ast::comparison> { using type = type_list<ast::arithmetic>; };
+template <> struct child_types<ast::arithmetic> {
+	using type = type_list<ast::add, ast::mul, ast::sub, ast::div, ast::mod, ast::exp, ast::arithmetic_value>;
+};
+template <> struct child_types<ast::add> { using type = type_list<ast::arithmetic>; };
+template <> struct child_types<ast::sub> { using type = type_list<ast::arithmetic>; };
+template <> struct child_types<ast::mul> { using type = type_list<ast::arithmetic>; };
+template <> struct child_types<ast::div> { using type = type_list<ast::arithmetic>; };
+template <> struct child_types<ast::mod> { using type = type_list<ast::arithmetic>; };
+template <> struct child_types<ast::exp> { using type = type_list<ast::arithmetic>; };
+template <> struct child_types<ast::arithmetic_value> { using type = type_list<ast::field>; };
+
+// Every node type that visit<> can reach, in no particular order
+using visited_types = type_list<ast::program, ast::trait, ast::unit_traits, ast::trait_initializer, ast::properties,
+	ast::variable_decl, ast::variable_type, ast::always_body, ast::assignment, ast::continuous_if, ast::transition_if,
+	ast::for_in, ast::logical, ast::and_op, ast::or_op, ast::negated, ast::comparison, ast::val_bool, ast::arithmetic,
+	ast::add, ast::sub, ast::mul, ast::div, ast::mod, ast::exp, ast::arithmetic_value, ast::field>;
+
+template <typename T, typename List>
+struct type_index;
+template <typename T, typename... Rest>
+struct type_index<T, type_list<T, Rest...>> : std::integral_constant<size_t, 0> {};
+template <typename T, typename U, typename... Rest>
+struct type_index<T, type_list<U, Rest...>> : std::integral_constant<size_t, 1 + type_index<T, type_list<Rest...>>::value> {};
+
+template <size_t N>
+using type_matrix = std::array<std::array<bool, N>, N>;
+
+template <size_t N, typename... Children>
+constexpr void add_child_types(type_matrix<N>& reachable, size_t parent, type_list<Children...>) {
+	((reachable[parent][type_index<Children, visited_types>::value] = true), ...);
+}
+
+// Computes whether a node of each type can have a node of each other type somewhere in its subtree, including itself
+template <typename... Types>
+constexpr auto compute_reachable_types(type_list<Types...>) -> type_matrix<sizeof...(Types)> {
+	constexpr auto n = sizeof...(Types);
+	auto reachable = type_matrix<n>();
+	auto parent = size_t(0);
+	((add_child_types<n>(reachable, parent++, typename child_types<Types>::type()), ...));
+	for (size_t i = 0; i < n; i++) {
+		reachable[i][i] = true;
+	}
+	// Transitive closure, since the type graph has cycles through if statements and loops
+	for (size_t k = 0; k < n; k++) {
+		for (size_t i = 0; i < n; i++) {
+			for (size_t j = 0; j < n; j++) {
+				reachable[i][j] = reachable[i][j] || (reachable[i][k] && reachable[k][j]);
+			}
+		}
+	}
+	return reachable;
+}
+
+// Whether visiting a node of type AstNode could call any method of the visitor, either on the node itself or anywhere
+//  beneath it, which allows visit<> to skip entire subtrees, such as expressions when a visitor only handles bodies
+template <typename Visitor, typename AstNode>
+struct visits_subtree {
+	template <typename... Types>
+	static constexpr auto handled_types(type_list<Types...>) -> std::array<bool, sizeof...(Types)> {
+		return {(has_visitor<Visitor, Types>::value || has_enter<Visitor, Types>::value)...};
+	}
+
+	static constexpr auto compute() -> bool {
+		constexpr auto reachable = compute_reachable_types(visited_types());
+		constexpr auto handled = handled_types(visited_types());
+		constexpr auto node = type_index<AstNode, visited_types>::value;
+		for (size_t i = 0; i < handled.size(); i++) {
+			if (reachable[node][i] && handled[i]) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static constexpr bool value = compute();
+};
+
 template <typename AstNode, typename Visitor, typename Impl>
 struct default_visit {
 	void operator()(AstNode& n, Visitor& visitor) {
-		// Visit children first so that nodes are traversed in reverse topological order
-		Impl::visit_children(n, visitor);
-		// Default behavior for any AST node is to visit it
+		if constexpr (visits_subtree<Visitor, AstNode>::value) {
+			if constexpr (has_enter<Visitor, AstNode>::value) {
+				if (!visitor.enter(n)) {
+					return;
+				}
+			}
+			// Visit children first so that nodes are traversed in reverse topological order
+			Impl::visit_children(n, visitor);
+			// Default behavior for any AST node is to visit it
+			if constexpr (has_visitor<Visitor, AstNode>::value) {
+				visitor(n);
+			}
+		}
+	}
+};
+
+// Whether the visitor has an enter method for any type of node
+template <typename Visitor, typename... Types>
+constexpr auto has_enter_for_any(type_list<Types...>) -> bool {
+	return (has_enter<Visitor, Types>::value || ...);
+}
+
+// Visitor that calls several visitors at each node, in the order they were given, so that passes which do not
+//  depend on each other's changes elsewhere in the tree can share a single traversal
+// A node is only visited by the visitors that have a visit method for it, and is skipped entirely if none do
+template <typename... Visitors>
+struct visitor_pack {
+	static_assert(!(has_enter_for_any<Visitors>(visited_types()) || ...), "Visitors with an enter method cannot share a traversal");
+
+	visitor_pack(Visitors&... visitors) : visitors(visitors...) {}
+
+	template <typename AstNode, typename = std::enable_if_t<(has_visitor<Visitors, AstNode>::value || ...)>>
+	void operator()(AstNode& n) {
+		std::apply([&](auto&... visitor) { (visit_with(visitor, n), ...); }, visitors);
+	}
+
+private:
+	template <typename Visitor, typename AstNode>
+	static void visit_with(Visitor& visitor, AstNode& n) {
 		if constexpr (has_visitor<Visitor, AstNode>::value) {
 			visitor(n);
 		}
 	}
+
+	std::tuple<Visitors&...> visitors;
 };
 
 template <typename AstNode, typename Visitor>
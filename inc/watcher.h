@@ -0,0 +1,53 @@
+#pragma once
+
+#include "compiler.h"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+// Compiles the input, and compiles it again whenever one of the files of the program changes, including the files it
+//  imports. Directories are watched rather than files, so that editors that save by replacing a file are noticed
+// Files that have not changed are not parsed again, and traits that have not changed are not simplified again
+class watcher {
+public:
+	struct options {
+		std::vector<std::string> input_files;
+		std::string cache_dir;
+		bool maude_check = false;
+		unsigned jobs = 1;
+		glc::pass_checks check_passes = glc::pass_checks::changed;
+		// Changes are collected until none have happened for this long, so that saving several files only rebuilds once
+		// Only changes to files of the program count, so other files written next to them do not delay the rebuild
+		std::chrono::milliseconds debounce = std::chrono::milliseconds(100);
+	};
+
+	watcher(options opts);
+	~watcher();
+
+	watcher(watcher const&) = delete;
+	auto operator=(watcher const&) -> watcher& = delete;
+
+	// Builds and rebuilds the program until watching fails, and returns false if files could not be watched at all
+	auto run() -> bool;
+
+private:
+	// Compiles the program, prints the result and how long it took, and watches the files that make it up
+	// Rebuilds also print how long it took since the change that caused them, which includes the debounce period
+	void build(std::optional<std::chrono::steady_clock::time_point> changed_at);
+	// Watches the directories containing the files, and stops watching directories that no longer contain any
+	void watch(std::vector<std::string> const& files);
+	// Waits for a change to a file of the program followed by a quiet period, returning the time of the first change
+	auto wait_for_change() -> std::optional<std::chrono::steady_clock::time_point>;
+
+	options opts;
+	glc::shared_maude maude;
+
+	int inotify_fd = -1;
+	// Watched directories by watch descriptor, and the canonical paths of the files of the program within them
+	std::unordered_map<int, std::string> directories;
+	std::unordered_set<std::string> files;
+};
@@ -0,0 +1,39 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+static thread_local arena* current_arena = nullptr;
+
+auto arena::allocate(size_t size, size_t alignment) -> void* {
+	auto address = reinterpret_cast<uintptr_t>(next);
+	auto padding = (alignment - address % alignment) % alignment;
+
+	if (!next || padding + size > static_cast<size_t>(end - next)) {
+		// Allocations larger than a chunk get a chunk of their own
+		auto new_chunk_size = std::max(chunk_size, size + alignment);
+		chunks.emplace_back(new char[new_chunk_size]);
+		next = chunks.back().get();
+		end = next + new_chunk_size;
+
+		address = reinterpret_cast<uintptr_t>(next);
+		padding = (alignment - address % alignment) % alignment;
+	}
+
+	auto result = next + padding;
+	next = result + size;
+	num_bytes += padding + size;
+	return result;
+}
+
+auto arena::current() -> arena* {
+	return current_arena;
+}
+
+arena::scope::scope(arena& a) : previous(current_arena) {
+	current_arena = &a;
+}
+
+arena::scope::~scope() {
+	current_arena = previous;
+}
@@ -127,7 +127,7 @@ assign_variables::assign_variables(pass_manager& pm) {
 	}
 }
 
-auto assign_variables::get_assignment(string variable) -> assignment {
+auto assign_variables::get_assignment(ast::symbol variable) -> assignment {
 	assert(assignments.find(variable) != assignments.end());
 	return assignments[variable];
 }
\ No newline at end of file
@@ -1,10 +1,110 @@
 #include "ast.h"
 #include "visitor.h"
+#include "arena.h"
 
 #include <iostream>
 #include <algorithm>
+#include <deque>
+#include <mutex>
+#include <new>
 
 namespace ast {
+	// Files are stored in a deque so that references returned by name() stay valid as more files are added
+	struct file_entry {
+		string name;
+		std::weak_ptr<std::string_view const> contents;
+		// Offsets at which each line starts, built from the contents when the first offset is resolved
+		vector<uint32_t> line_starts;
+	};
+
+	static std::mutex file_table_lock;
+	static std::deque<file_entry> files = {file_entry {""}};
+	// Ids of the entries whose contents have been released, which are given to the next files added
+	static vector<file_table::file_id> free_ids;
+
+	auto file_table::add(string const& filename, std::string_view contents, std::shared_ptr<void const> owner)
+		-> std::pair<file_id, std::shared_ptr<std::string_view const>>
+	{
+		auto guard = std::lock_guard(file_table_lock);
+		auto id = file_id(0);
+		if (!free_ids.empty()) {
+			id = free_ids.back();
+			free_ids.pop_back();
+		} else {
+			id = static_cast<file_id>(files.size());
+			files.emplace_back();
+		}
+
+		// No node can refer to the entry once the contents are released, so it is cleared and reused right away
+		auto owned = std::shared_ptr<std::string_view const>(new std::string_view(contents),
+			[id, owner = std::move(owner)](std::string_view const* released) mutable {
+			delete released;
+			owner.reset();
+			auto guard = std::lock_guard(file_table_lock);
+			files[id] = file_entry();
+			free_ids.push_back(id);
+		});
+		files[id] = file_entry {filename, owned};
+		return {id, std::move(owned)};
+	}
+
+	auto file_table::name(file_id id) -> string const& {
+		auto guard = std::lock_guard(file_table_lock);
+		return files[id].name;
+	}
+
+	auto file_table::resolve(file_id id, uint32_t offset) -> std::pair<size_t, size_t> {
+		// Declared before the lock is taken, so that if this is the last reference to the contents, they are released
+		//  after the lock is, since releasing them takes the lock
+		auto contents = std::shared_ptr<std::string_view const>();
+		auto guard = std::lock_guard(file_table_lock);
+		auto& entry = files[id];
+		contents = entry.contents.lock();
+		if (!contents) {
+			return {0, 0};
+		}
+
+		if (entry.line_starts.empty()) {
+			entry.line_starts.push_back(0);
+			for (auto pos = contents->find('\n'); pos != std::string_view::npos; pos = contents->find('\n', pos + 1)) {
+				entry.line_starts.push_back(pos + 1);
+			}
+		}
+
+		// The line containing the offset is the last one starting at or before it
+		auto next_line = std::upper_bound(entry.line_starts.begin(), entry.line_starts.end(), offset);
+		auto line = static_cast<size_t>(next_line - entry.line_starts.begin());
+		return {line, offset - *(next_line - 1) + 1};
+	}
+
+	// Every node is preceded by a header recording the arena it was allocated from, or nullptr if it was
+	//  allocated on the heap, so that deleting a node knows whether its memory needs to be freed
+	struct alignas(std::max_align_t) node_header {
+		arena* owner;
+	};
+
+	auto node::operator new(size_t size) -> void* {
+		auto owner = arena::current();
+		auto total_size = sizeof(node_header) + size;
+		auto memory = owner ? owner->allocate(total_size, alignof(node_header)) : ::operator new(total_size);
+		return new (memory) node_header {owner} + 1;
+	}
+
+	void node::operator delete(void* ptr, size_t size) {
+		auto header = static_cast<node_header*>(ptr) - 1;
+		if (!header->owner) {
+			::operator delete(header);
+		}
+	}
+
+	void mark_changed(node& n) {
+		n.changed_ = true;
+		// Ancestors that are already marked have had the rest of the path up to the root marked as well
+		for (auto cur = n.parent(); cur && !cur->changed_below_; cur = cur->parent()) {
+			cur->changed_below_ = true;
+		}
+	}
+
 	auto ty_int::make(long min, long max) -> unique_ptr<ty_int> {
 		auto result = make_unique<ty_int>();
 		result->min = min;
@@ -44,7 +144,7 @@ namespace ast {
 		return type == type_enum::BOOL;
 	}
 
-	auto variable_decl::make(unique_ptr<variable_type>&& type, string name) -> unique_ptr<variable_decl> {
+	auto variable_decl::make(unique_ptr<variable_type>&& type, symbol name) -> unique_ptr<variable_decl> {
 		auto result = make_unique<variable_decl>();
 		result->type = std::move(type);
 		result->name = name;
@@ -78,7 +178,7 @@ namespace ast {
 		variable_declarations.emplace_back(std::move(decl));
 	}
 
-	auto field::make(unit_object unit, member_op_enum member_op, string field_name, bool is_rate) -> unique_ptr<field> {
+	auto field::make(unit_object unit, member_op_enum member_op, symbol field_name, bool is_rate) -> unique_ptr<field> {
 		auto result = make_unique<field>();
 		result->unit = unit;
 		result->member_op = member_op;
@@ -103,6 +203,9 @@ namespace ast {
 				break;
 			}
 			case member_op_enum::CUSTOM: {
+				if (resolved) {
+					return resolved_decl ? resolved_decl->type.get() : nullptr;
+				}
 				auto unit_trait = get_trait();
 				if (!unit_trait) {
 					return nullptr;
@@ -121,11 +224,17 @@ namespace ast {
 	}
 
 	auto field::get_loop_from_identifier() -> for_in* {
+		if (resolved) {
+			return resolved_loop;
+		}
 		auto& identifier = std::get<identifier_unit>(unit).identifier;
 		return find_parent<for_in>(*this, [&] (for_in& loop) { return loop.variable == identifier; });
 	}
 
 	auto field::get_trait() -> trait* {
+		if (resolved) {
+			return resolved_trait;
+		}
 		if (!std::holds_alternative<identifier_unit>(unit)) {
 			return find_parent<trait>(*this);
 		}
@@ -305,7 +414,7 @@ namespace ast {
 		return make(condition->clone(), body->clone());
 	}
 
-	auto for_in::make(string variable, double range, unit_object range_unit, vector<string>& traits, unique_ptr<always_body>&& body) -> unique_ptr<for_in> {
+	auto for_in::make(symbol variable, double range, unit_object range_unit, vector<symbol>& traits, unique_ptr<always_body>&& body) -> unique_ptr<for_in> {
 		auto result = make_unique<for_in>();
 		result->variable = variable;
 		result->range = range;
@@ -326,6 +435,9 @@ namespace ast {
 	}
 
 	auto for_in::get_loop_from_identifier() -> for_in* {
+		if (resolved) {
+			return resolved_loop;
+		}
 		auto identifier = std::get<identifier_unit>(range_unit).identifier;
 		return find_parent<for_in>(*this->parent(), [&] (for_in& loop) { return loop.variable == identifier; });
 	}
@@ -356,7 +468,7 @@ namespace ast {
 		exprs.emplace_back(std::move(expr));
 	}
 
-	auto trait::make(string name, unique_ptr<properties>&& props, unique_ptr<always_body>&& body) -> unique_ptr<trait> {
+	auto trait::make(symbol name, unique_ptr<properties>&& props, unique_ptr<always_body>&& body) -> unique_ptr<trait> {
 		auto result = make_unique<trait>();
 		result->name = name;
 		result->props = std::move(props);
@@ -369,7 +481,7 @@ namespace ast {
 		return make(name, props->clone(), body->clone());
 	}
 
-	auto trait::get_property(string name) -> variable_decl* {
+	auto trait::get_property(symbol name) -> variable_decl* {
 		for (auto& prop : props->variable_declarations) {
 			if (prop->name == name) {
 				return prop.get();
@@ -378,7 +490,7 @@ namespace ast {
 		return nullptr;
 	}
 
-	auto trait_initializer::make(string name, map<string, literal_value> initial_values) -> unique_ptr<trait_initializer> {
+	auto trait_initializer::make(symbol name, map<symbol, literal_value> initial_values) -> unique_ptr<trait_initializer> {
 		auto result = make_unique<trait_initializer>();
 		result->name = name;
 		result->initial_values = initial_values;
@@ -403,7 +515,7 @@ namespace ast {
 		auto result = make_unique<unit_traits>();
 		result->name = name;
 		for (auto& trait : traits) {
-			result->traits.push_back(trait->clone());
+			result->insert_initializer(trait->clone());
 		}
 		return std::move(result);
 	}
@@ -446,7 +558,7 @@ namespace ast {
 		traits.emplace_back(std::move(trait));
 	}
 
-	auto program::get_trait(string name) -> trait* {
+	auto program::get_trait(symbol name) -> trait* {
 		for (auto& trait : traits) {
 			if (trait->name == name) {
 				return trait.get();
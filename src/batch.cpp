@@ -0,0 +1,119 @@
+#include "batch.h"
+#include "thread_pool.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <mutex>
+
+#define TTY_RESET "\033[0m"
+#define TTY_RED "\033[1m\033[31m"
+#define TTY_GREEN "\033[1m\033[32m"
+#define TTY_CYAN "\033[1m\033[36m"
+
+using std::string;
+using std::vector;
+using std::optional;
+
+using steady_clock = std::chrono::steady_clock;
+
+auto batch::read_manifest(string const& filename) -> optional<vector<map_files>> {
+	auto file = std::ifstream(filename);
+	if (!file) {
+		return std::nullopt;
+	}
+
+	auto maps = vector<map_files>();
+	for (auto line = string(); std::getline(file, line);) {
+		auto files = map_files();
+		auto stream = std::istringstream(line);
+		for (auto path = string(); stream >> path;) {
+			files.push_back(path);
+		}
+		if (!files.empty() && files.front()[0] != '#') {
+			maps.push_back(std::move(files));
+		}
+	}
+	return maps;
+}
+
+batch::batch(options opts) : opts(opts), maude(opts.cache_dir, opts.maude_check) {}
+
+auto batch::run() -> bool {
+	auto start_time = steady_clock::now();
+	auto milliseconds = [](steady_clock::duration d) {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+	};
+
+	// Threads that would be left idle by having fewer maps than threads are given to the compilations instead
+	auto jobs = std::max(opts.jobs, 1U);
+	auto maps_at_once = std::min<size_t>(jobs, std::max<size_t>(opts.maps.size(), 1));
+	auto jobs_per_map = std::max<unsigned>(jobs / maps_at_once, 1);
+
+	// Idle workers take the next map from the queue, so queueing the largest maps first keeps the run from ending
+	//  with a single large map compiling while the other workers have nothing left to do
+	auto sizes = vector<uintmax_t>(opts.maps.size());
+	for (size_t i = 0; i < opts.maps.size(); i++) {
+		for (auto& path : opts.maps[i]) {
+			auto error = std::error_code();
+			auto size = std::filesystem::file_size(path, error);
+			sizes[i] += error ? 0 : size;
+		}
+	}
+	auto order = vector<size_t>(opts.maps.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+	auto output_lock = std::mutex();
+	auto failed = size_t(0);
+	auto compile_time = steady_clock::duration::zero();
+
+	auto pool = thread_pool(maps_at_once);
+	for (auto index : order) {
+		pool.submit([&, index](unsigned) {
+			auto& files = opts.maps[index];
+			auto map_start = steady_clock::now();
+
+			auto compile_opts = glc::options();
+			for (size_t i = 1; i < files.size(); i++) {
+				compile_opts.more_sources.push_back({files[i]});
+			}
+			compile_opts.cache_dir = opts.cache_dir;
+			compile_opts.maude_check = opts.maude_check;
+			maude.share_with(compile_opts);
+			compile_opts.jobs = jobs_per_map;
+			compile_opts.check_passes = opts.check_passes;
+			auto result = glc::compile({files.front()}, compile_opts);
+
+			auto elapsed = steady_clock::now() - map_start;
+			auto guard = std::lock_guard(output_lock);
+			compile_time += elapsed;
+			for (auto& error : result.errors) {
+				std::cout << error << std::endl;
+			}
+			if (result.success) {
+				std::cout << TTY_GREEN << files.front() << ": Compilation succeeded" << TTY_RESET;
+			} else {
+				failed++;
+				std::cout << TTY_RED << files.front() << ": Compilation failed due to at least " << result.errors.size() <<
+					(result.errors.size() == 1 ? " error" : " errors") << TTY_RESET;
+			}
+			std::cout << " in " << milliseconds(elapsed) << " ms" << std::endl;
+		});
+	}
+	pool.wait();
+
+	std::cout << TTY_CYAN << "Compiled " << opts.maps.size() << (opts.maps.size() == 1 ? " map" : " maps") << " (" <<
+		failed << " failed) in " << milliseconds(steady_clock::now() - start_time) << " ms, " << milliseconds(compile_time) <<
+		" ms of compilation on " << maps_at_once << (maps_at_once == 1 ? " thread" : " threads") << TTY_RESET << std::endl;
+	if (maude.memo) {
+		std::cout << "Maude memo: " << maude.memo->hits() << " hits, " << maude.memo->misses() << " misses" << std::endl;
+	}
+	return failed == 0;
+}
@@ -9,8 +9,6 @@ using std::unique_ptr;
 using std::make_unique;
 using std::string;
 
-cli_command cli_parser;
-
 auto cli_command::add_subcommand(string const& command) -> cli_command* {
     assert(command != "help" && "help is a reserved subcommand");
     subcommands[command] = make_unique<cli_command>();
@@ -115,7 +113,7 @@ auto cli_command::parse(string const& command, int argc, char **argv) -> bool {
             if (std::holds_alternative<bool*>(options[flag])) {
                 *std::get<bool*>(options[flag]) = true;
                 parsed_options.insert(flag);
-                break;
+                continue;
             }
 
             // We expect an argument for the rest of the types
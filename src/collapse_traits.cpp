@@ -8,6 +8,7 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <unordered_map>
 #include <tuple>
 
 using std::string;
@@ -15,8 +16,12 @@ using std::vector;
 using std::unique_ptr;
 using std::make_unique;
 using std::map;
+using std::unordered_map;
 using std::tuple;
 
+// Map from trait name to the name of the bitfield variable that records whether a unit has the trait, and its bit
+using trait_bitfields = unordered_map<ast::symbol, tuple<ast::symbol, unsigned>>;
+
 collapse_traits::collapse_traits(pass_manager& pm)
 	: pm(pm), program(*pm.get_pass<parser>()->program)
 {
@@ -30,9 +35,9 @@ collapse_traits::collapse_traits(pass_manager& pm)
 struct rename_variable_uses_visitor {
 	pass_manager& pm;
 	ast::program& program;
-	string trait_name;
+	ast::symbol trait_name;
 
-	rename_variable_uses_visitor(pass_manager& pm, ast::program& program, string trait_name)
+	rename_variable_uses_visitor(pass_manager& pm, ast::program& program, ast::symbol trait_name)
 		: pm(pm), program(program), trait_name(trait_name) {}
 
 	void operator()(ast::field& f) {
@@ -40,11 +45,13 @@ struct rename_variable_uses_visitor {
 		if (f.member_op != ast::member_op_enum::CUSTOM) {
 			return;
 		}
+		// Declarations of earlier traits have already been renamed, so the declaration could not be found by name
+		assert(f.resolved);
 
 		std::visit(ast::overloaded {
 			[&] (ast::this_unit& _) {
 				auto cur_trait = ast::find_parent<ast::trait>(f);
-				f.field_name = cur_trait->name + "~" + f.field_name;
+				f.field_name = ast::symbol::compose(cur_trait->name, f.field_name);
 			},
 			[&] (ast::type_unit& _) {
 				assert(false);
@@ -52,44 +59,43 @@ struct rename_variable_uses_visitor {
 			[&] (ast::identifier_unit& _) {
 				auto origin_trait = f.get_trait()->name;
 				assert(!origin_trait.empty());
-				f.field_name = origin_trait + "~" + f.field_name;
+				f.field_name = ast::symbol::compose(origin_trait, f.field_name);
 			}
 		}, f.unit);
 	}
 
 	void operator()(ast::trait_initializer& t) {
-		auto new_initial_values = map<string, ast::literal_value>();
+		auto new_initial_values = map<ast::symbol, ast::literal_value>();
 		for (auto& [field_name, value] : t.initial_values) {
-			new_initial_values[t.name + "~" + field_name] = value;
+			new_initial_values[ast::symbol::compose(t.name, field_name)] = value;
 		}
 		t.initial_values = new_initial_values;
 	}
 };
 
 struct rename_variable_decls_visitor {
-	string trait_name;
+	ast::symbol trait_name;
 
-	rename_variable_decls_visitor(string trait_name) : trait_name(trait_name) {}
+	rename_variable_decls_visitor(ast::symbol trait_name) : trait_name(trait_name) {}
 
 	void operator()(ast::variable_decl& decl) {
-		decl.name = trait_name + "~" + decl.name;
+		decl.name = ast::symbol::compose(trait_name, decl.name);
 	}
 };
 
 void collapse_traits::rename_variables() {
+	// Uses and declarations are renamed in the same walk, which relies on fields having been resolved to their
+	//  declarations by resolve_symbols, since a search by name would no longer find the renamed declarations
 	for (auto& trait : program.traits) {
 		auto rvu = rename_variable_uses_visitor(pm, program, trait->name);
-		visit<ast::trait, decltype(rvu)>()(*trait, rvu);
-	}
-
-	for (auto& trait : program.traits) {
 		auto rvd = rename_variable_decls_visitor(trait->name);
-		visit<ast::trait, decltype(rvd)>()(*trait, rvd);
+		auto renamer = visitor_pack(rvu, rvd);
+		visit<ast::trait, decltype(renamer)>()(*trait, renamer);
 	}
 }
 
 // Returns a comparison that evaluates true when the provided unit object has the specified trait
-auto get_trait_check(ast::unit_object const& unit, map<string, tuple<string, unsigned>>& trait_bitfield, string const& trait)
+auto get_trait_check(ast::unit_object const& unit, trait_bitfields& trait_bitfield, ast::symbol trait)
 	-> unique_ptr<ast::comparison>
 {
 	using namespace ast;
@@ -111,9 +117,9 @@ auto get_trait_check(ast::unit_object const& unit, map<string, tuple<string, uns
 }
 
 struct insert_trait_checks_visitor {
-	map<string, tuple<string, unsigned>>& trait_bitfield;
+	trait_bitfields& trait_bitfield;
 
-	insert_trait_checks_visitor(map<string, tuple<string, unsigned>>& trait_bitfield)
+	insert_trait_checks_visitor(trait_bitfields& trait_bitfield)
 		: trait_bitfield(trait_bitfield) {}
 
 	void operator()(ast::for_in& loop) {
@@ -170,7 +176,7 @@ void collapse_traits::create_collapsed_trait() {
 	}
 
 	// Map from trait name to variable name / bitposition pair
-	auto trait_bitfield = map<string, tuple<string, unsigned>>();
+	auto trait_bitfield = trait_bitfields();
 	for (size_t i = 0; i < program.traits.size(); i++) {
 		auto variable_name = "trait_bitfield" + std::to_string(i / ast::ty_int::num_bits);
 		auto bitposition = i % ast::ty_int::num_bits;
@@ -207,8 +213,9 @@ void collapse_traits::create_collapsed_trait() {
 		// Iterate through all the old traits
 		for (auto& trait_initializer : cur_unit_traits->traits) {
 			// Add the initial values for the current trait with transformed variable names
+			auto prefix = ast::symbol::compose({}, trait_initializer->name);
 			for (auto& [field_name, initial_value] : trait_initializer->initial_values) {
-				initial_values["~" + trait_initializer->name + "~" + field_name] = initial_value;
+				initial_values[ast::symbol::compose(prefix, field_name)] = initial_value;
 			}
 
 			// Add a bit in the bitfield indicating that this trait is active
@@ -223,4 +230,7 @@ void collapse_traits::create_collapsed_trait() {
 		cur_unit_traits->traits.clear();
 		cur_unit_traits->insert_initializer(std::move(main_trait_initializer));
 	}
+
+	// Every trait and every name in the program was replaced, so all of it needs to be checked again
+	ast::mark_changed(program);
 }
@@ -0,0 +1,175 @@
+#include "compiler.h"
+#include "parser.h"
+#include "pass_manager.h"
+#include "simplify_traits.h"
+#include "semantic_checker.h"
+#include "resolve_symbols.h"
+#include "collapse_traits.h"
+#include "print_program.h"
+#include "merge_ifs.h"
+#include "assign_variables.h"
+#include "arena.h"
+#include "thread_pool.h"
+
+#include <string>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <filesystem>
+#include <algorithm>
+
+#define TTY_RESET "\033[0m"
+#define TTY_CYAN "\033[1m\033[36m"
+
+using std::string;
+using std::vector;
+
+namespace glc {
+	// Decides whether a compilation with sampled checks checks the program after each pass
+	// The decision only depends on the contents of the program, so that compiling the same program again, for
+	//  example with -check_passes full to reproduce a failed check, makes the same decision
+	static auto sample_checks(parser const& parsed) -> bool {
+		return parsed.contents_hash() % 8 == 0;
+	}
+
+	auto memo_file(string const& cache_dir) -> string {
+		if (cache_dir.empty()) {
+			return "";
+		}
+		auto error = std::error_code();
+		std::filesystem::create_directories(cache_dir, error);
+		return cache_dir + "/maude.memo";
+	}
+
+	shared_maude::shared_maude(string const& cache_dir, bool maude_check) {
+		if (maude_check) {
+			memo.emplace("lwg.maude", memo_file(cache_dir));
+			processes.emplace("lwg.maude", &*memo);
+		}
+	}
+
+	void shared_maude::share_with(options& opts) {
+		opts.memo = memo ? &*memo : nullptr;
+		opts.maude_processes = processes ? &*processes : nullptr;
+	}
+
+	auto compile(source const& input, options const& opts) -> result {
+		auto res = result();
+
+		// All AST nodes live in this arena, which is declared first so that it outlives the passes that own them
+		auto ast_arena = arena();
+		auto ast_arena_scope = arena::scope(ast_arena);
+
+		pass_manager pm;
+
+		// Maude reductions are memoized within this compilation, and across compilations if there is a cache directory
+		auto own_memo = std::optional<maude_memo>();
+		auto memo = opts.memo;
+		if (opts.maude_check && !memo) {
+			memo = &own_memo.emplace("lwg.maude", memo_file(opts.cache_dir));
+		}
+		// Likewise, the Maude processes are started once for the whole compilation rather than for every trait merged
+		auto own_processes = std::optional<maude_pool>();
+		auto maude_processes = opts.maude_processes;
+		if (opts.maude_check && !maude_processes) {
+			maude_processes = &own_processes.emplace("lwg.maude", memo);
+		}
+
+		try {
+			// The parser shares given contents instead of copying them
+			auto input_files = vector<string>();
+			auto parser_opts = parser::options();
+			parser_opts.jobs = std::max(opts.jobs, 1U);
+			auto add_source = [&](source const& file) {
+				input_files.push_back(file.path);
+				if (file.contents) {
+					parser_opts.contents[file.path] = file.contents;
+				}
+			};
+			add_source(input);
+			for (auto& file : opts.more_sources) {
+				add_source(file);
+			}
+			for (auto& file : opts.file_contents) {
+				if (file.contents) {
+					parser_opts.contents[file.path] = file.contents;
+				}
+			}
+
+			auto parsed = pm.run_pass<parser>(input_files, parser_opts);
+			res.num_files = parsed->num_files();
+			res.num_reused_files = parsed->num_reused();
+			DEBUG(std::cout << TTY_CYAN << "parser" << TTY_RESET << " (" << parsed->num_files() << " files, " <<
+				parsed->num_reused() << " reused)" << std::endl);
+			pm.run_pass<resolve_symbols>();
+			pm.run_pass<semantic_checker>();
+
+			// After parsing, passes are trusted to produce valid programs unless they are checked, but what they
+			//  changed is always resolved again, since later passes look up fields
+			auto check_mode = opts.check_passes == pass_checks::full ?
+				semantic_checker::mode::full : semantic_checker::mode::changed;
+			auto checked = opts.check_passes == pass_checks::full || opts.check_passes == pass_checks::changed ||
+				(opts.check_passes == pass_checks::sampled && sample_checks(*parsed));
+			auto check_pass = [&] {
+				pm.run_pass<resolve_symbols>();
+				if (checked) {
+					pm.run_pass<semantic_checker>(check_mode);
+				} else if (opts.check_passes == pass_checks::debug) {
+					DEBUG(pm.run_pass<semantic_checker>(check_mode));
+				}
+			};
+
+			print_program pp(*pm.get_pass<parser>()->program);
+			DEBUG(std::cout << TTY_CYAN << "original input" << TTY_RESET << std::endl);
+			DEBUG(pp.write(std::cout); std::cout << std::endl);
+
+			// Every trait is merged separately, and then the whole program, all by the same threads
+			auto merge_workers = thread_pool(std::max(opts.jobs, 1U));
+			auto merge_opts = merge_ifs::options();
+			merge_opts.maude_check = opts.maude_check;
+			merge_opts.memo = memo;
+			merge_opts.maude_processes = maude_processes;
+			merge_opts.workers = &merge_workers;
+			merge_opts.jobs = std::max(opts.jobs, 1U);
+
+			auto simplify_opts = simplify_traits::options();
+			simplify_opts.cache_dir = opts.cache_dir;
+			simplify_opts.merge_opts = merge_opts;
+			auto simplified = pm.run_pass<simplify_traits>(simplify_opts);
+			res.num_reused_traits = simplified->num_reused();
+			res.num_processed_traits = simplified->num_processed();
+			check_pass();
+			DEBUG(std::cout << TTY_CYAN << "simplify_traits" << TTY_RESET << " (" << simplified->num_reused() << " reused, " <<
+				simplified->num_processed() << " processed)" << std::endl);
+			DEBUG(pp.write(std::cout); std::cout << std::endl);
+
+			pm.run_pass<collapse_traits>();
+			check_pass();
+			DEBUG(std::cout << TTY_CYAN << "collapse_traits" << TTY_RESET << std::endl);
+			DEBUG(pp.write(std::cout); std::cout << std::endl);
+
+			pm.run_pass<merge_ifs>(merge_opts);
+			check_pass();
+			DEBUG(std::cout << TTY_CYAN << "merge_ifs" << TTY_RESET << std::endl);
+			DEBUG(pp.write(std::cout); std::cout << std::endl);
+
+			DEBUG(std::cout << TTY_CYAN << "assign_variables" << TTY_RESET << std::endl);
+			pm.run_pass<assign_variables>();
+			DEBUG(std::cout << std::endl);
+
+			res.success = true;
+		} catch (vector<string>& errors) {
+			res.errors = std::move(errors);
+		}
+
+		// The parser is kept by the pass manager even if it failed, so the files it read can still be reported
+		res.files = pm.get_pass<parser>()->file_paths();
+
+		if (memo) {
+			res.memo_hits = memo->hits();
+			res.memo_misses = memo->misses();
+		}
+		return res;
+	}
+}
@@ -0,0 +1,111 @@
+#include "expr_table.h"
+#include "hash.h"
+
+#include <cstring>
+#include <memory>
+#include <variant>
+#include <cassert>
+
+using std::string;
+using std::vector;
+using std::unique_ptr;
+
+auto expr_table::intern(kind k, string atom, vector<expr_id> args) -> expr_id {
+	auto h = hash::combine(hash::fnv_offset_basis, static_cast<uint64_t>(k));
+	h = hash::fnv1a(atom, h);
+	for (auto arg : args) {
+		h = hash::combine(h, entries[arg].hash);
+	}
+
+	auto e = entry {k, std::move(atom), std::move(args), h};
+	auto it = ids.find(e);
+	if (it != ids.end()) {
+		return it->second;
+	}
+
+	auto id = static_cast<expr_id>(entries.size());
+	ids.emplace(e, id);
+	entries.push_back(std::move(e));
+	return id;
+}
+
+auto expr_table::intern(ast::field& n) -> expr_id {
+	auto atom = string();
+	std::visit(ast::overloaded {
+		[&] (ast::this_unit _) { atom = "this"; },
+		[&] (ast::type_unit _) { atom = "type"; },
+		[&] (ast::identifier_unit u) { atom = "#" + u.identifier; }
+	}, n.unit);
+	atom += static_cast<char>('0' + n.member_op);
+	atom += n.is_rate ? "r" : "-";
+	atom += n.field_name;
+	return intern(kind::FIELD, atom, {});
+}
+
+auto expr_table::intern(ast::comparison& n) -> expr_id {
+	auto k = kind();
+	switch (n.comparison_type) {
+		case ast::comparison_enum::EQ: k = kind::EQ; break;
+		case ast::comparison_enum::NEQ: k = kind::NEQ; break;
+		case ast::comparison_enum::GT: k = kind::GT; break;
+		case ast::comparison_enum::LT: k = kind::LT; break;
+		case ast::comparison_enum::GTE: k = kind::GTE; break;
+		case ast::comparison_enum::LTE: k = kind::LTE; break;
+		default: assert(false);
+	}
+	return intern(k, "", {intern(*n.lhs), intern(*n.rhs)});
+}
+
+auto expr_table::intern(ast::arithmetic& n) -> expr_id {
+	if (auto it = node_ids.find(&n); it != node_ids.end()) {
+		return it->second;
+	}
+
+	auto binary = [&] (kind k, auto& op) {
+		return intern(k, "", {intern(*op->expr_1), intern(*op->expr_2)});
+	};
+
+	auto id = expr_id();
+	std::visit(ast::overloaded {
+		[&] (unique_ptr<ast::add>& v) { id = binary(kind::ADD, v); },
+		[&] (unique_ptr<ast::sub>& v) { id = binary(kind::SUB, v); },
+		[&] (unique_ptr<ast::mul>& v) { id = binary(kind::MUL, v); },
+		[&] (unique_ptr<ast::div>& v) { id = binary(kind::DIV, v); },
+		[&] (unique_ptr<ast::mod>& v) { id = binary(kind::MOD, v); },
+		[&] (unique_ptr<ast::exp>& v) { id = binary(kind::EXP, v); },
+		[&] (unique_ptr<ast::arithmetic_value>& v) {
+			std::visit(ast::overloaded {
+				[&] (unique_ptr<ast::field>& val) { id = intern(*val); },
+				[&] (long val) { id = intern(kind::INT, std::to_string(val), {}); },
+				[&] (double val) {
+					// Keyed by the bits of the value, since printing it would round
+					auto bits = uint64_t();
+					std::memcpy(&bits, &val, sizeof(bits));
+					id = intern(kind::FLOAT, std::to_string(bits), {});
+				}
+			}, v->value);
+		}
+	}, n.expr);
+
+	node_ids.emplace(&n, id);
+	return id;
+}
+
+auto expr_table::intern(ast::logical& n) -> expr_id {
+	if (auto it = node_ids.find(&n); it != node_ids.end()) {
+		return it->second;
+	}
+
+	auto id = expr_id();
+	std::visit(ast::overloaded {
+		[&] (unique_ptr<ast::and_op>& v) { id = intern(kind::AND, "", {intern(*v->expr_1), intern(*v->expr_2)}); },
+		[&] (unique_ptr<ast::or_op>& v) { id = intern(kind::OR, "", {intern(*v->expr_1), intern(*v->expr_2)}); },
+		[&] (unique_ptr<ast::field>& v) { id = intern(*v); },
+		[&] (unique_ptr<ast::val_bool>& v) { id = intern(kind::BOOL, v->value ? "true" : "false", {}); },
+		[&] (unique_ptr<ast::comparison>& v) { id = intern(*v); },
+		[&] (unique_ptr<ast::negated>& v) { id = intern(kind::NOT, "", {intern(*v->expr)}); }
+	}, n.expr);
+
+	node_ids.emplace(&n, id);
+	return id;
+}
@@ -1,79 +1,195 @@
 #include "cli.h"
-#include "parser.h"
-#include "pass_manager.h"
-#include "simplify_transition_ifs.h"
-#include "semantic_checker.h"
-#include "collapse_traits.h"
-#include "print_program.h"
-#include "merge_ifs.h"
-#include "assign_variables.h"
+#include "compiler.h"
+#include "server.h"
+#include "watcher.h"
+#include "batch.h"
 
 #include <string>
 #include <iostream>
-#include <memory>
 #include <vector>
+#include <algorithm>
+#include <optional>
 
 #define TTY_RESET "\033[0m"
 #define TTY_RED "\033[1m\033[31m"
 #define TTY_GREEN "\033[1m\033[32m"
-#define TTY_CYAN "\033[1m\033[36m"
 
 using std::string;
-using std::unique_ptr;
 using std::vector;
-using none = std::monostate;
+
+// Splits a comma separated list of files, ignoring empty entries
+static auto split_files(string const& list) -> vector<string> {
+    auto files = vector<string>();
+    for (size_t start = 0; start < list.size();) {
+        auto end = std::min(list.find(',', start), list.size());
+        if (end > start) {
+            files.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return files;
+}
+
+// Parses how passes are checked, as given by -check_passes
+static auto parse_pass_checks(string const& name) -> std::optional<glc::pass_checks> {
+    if (name == "full") {
+        return glc::pass_checks::full;
+    } else if (name == "changed") {
+        return glc::pass_checks::changed;
+    } else if (name == "sampled") {
+        return glc::pass_checks::sampled;
+    } else if (name == "debug") {
+        return glc::pass_checks::debug;
+    }
+    return std::nullopt;
+}
+
+// Options shared by glc and every subcommand that compiles
+struct compile_args {
+    string cache_dir;
+    bool maude_check;
+    int jobs;
+    string check_passes;
+};
+
+// Adds the options shared by every command that compiles, which only differ in what the jobs are used for
+static void add_compile_options(cli_command* command, compile_args* args, string const& jobs_description) {
+    command->add_option("cache_dir", "cache_directory", "Directory for results cached between compilations", &args->cache_dir, string(".glc_cache"));
+    command->add_option("maude_check", "", "Cross-check if statement merging against Maude (requires ./maude)", &args->maude_check, false);
+    command->add_option("j", "jobs", jobs_description, &args->jobs, 1);
+    command->add_option("check_passes", "mode", "Semantic checks after each pass: full, changed (only what the pass changed), sampled (changed, in one of eight compilations) or debug (debug builds only)", &args->check_passes, string("changed"));
+}
+
+// Sets the shared options of the options of a command, once the mode of -check_passes has been parsed
+template <typename Options>
+static void set_compile_options(Options& opts, compile_args const& args, glc::pass_checks check_passes) {
+    opts.cache_dir = args.cache_dir;
+    opts.maude_check = args.maude_check;
+    opts.jobs = static_cast<unsigned>(std::max(args.jobs, 1));
+    opts.check_passes = check_passes;
+}
 
 int main(int argc, char **argv) {
     // Arguments for command glc ...
     string input_file;
+    string more_input_files;
     string output_file;
+    compile_args args;
+
+    auto cli = cli_command();
+    cli.add_argument("input_file", "The LWG file to be compiled", &input_file);
+    cli.add_option("i", "input_files", "Additional LWG files to compile with the input, separated by commas", &more_input_files, string(""));
+    cli.add_option("o", "output_file", "The output JSON map file to be generated", &output_file, string("map.json"));
+    add_compile_options(&cli, &args, "Number of threads (and Maude processes) used to parse files and merge if statements");
+
+    // Arguments for command glc serve ...
+    string socket_path;
+    compile_args serve_args;
+
+    auto serve = cli.add_subcommand("serve");
+    serve->add_option("socket", "socket_path", "Unix socket to accept compile requests on, instead of reading them from stdin", &socket_path, string(""));
+    add_compile_options(serve, &serve_args, "Number of threads (and Maude processes) used by each compilation");
+
+    // Arguments for command glc watch ...
+    string watch_input_file;
+    string watch_more_input_files;
+    compile_args watch_args;
+    int debounce;
 
-    cli_parser.add_argument("input_file", "The LWG file to be compiled", &input_file);
-    cli_parser.add_option("o", "output_file", "The output JSON map file to be generated", &output_file, string("map.json"));
+    auto watch = cli.add_subcommand("watch");
+    watch->add_argument("input_file", "The LWG file to be compiled whenever it or a file it imports changes", &watch_input_file);
+    watch->add_option("i", "input_files", "Additional LWG files to compile with the input, separated by commas", &watch_more_input_files, string(""));
+    add_compile_options(watch, &watch_args, "Number of threads (and Maude processes) used by each compilation");
+    watch->add_option("debounce", "milliseconds", "Time without further changes to wait for before recompiling", &debounce, 100);
+
+    // Arguments for command glc batch ...
+    string manifest_file;
+    string batch_maps;
+    compile_args batch_args;
+
+    auto batch_command = cli.add_subcommand("batch");
+    batch_command->add_option("manifest", "manifest_file", "File listing one map per line, as the paths of its files separated by spaces", &manifest_file, string(""));
+    batch_command->add_option("maps", "input_files", "LWG files to compile as separate maps, separated by commas", &batch_maps, string(""));
+    add_compile_options(batch_command, &batch_args, "Number of threads (and Maude processes) shared by all maps");
 
     // Run CLI parser and exit on failure
-    if (!cli_parser.parse("glc", argc, argv)) {
+    if (!cli.parse("glc", argc, argv)) {
         return 1;
     }
 
-    pass_manager pm;
-
-    try {
-        pm.run_pass<parser>(input_file);
-        pm.run_pass<semantic_checker>();
-
-        print_program pp(*pm.get_pass<parser>()->program);
-        DEBUG(std::cout << TTY_CYAN << "original input" << TTY_RESET << std::endl);
-        DEBUG(std::cout << pp.get_output() << std::endl);
+    auto& invoked_args = serve->was_invoked() ? serve_args : watch->was_invoked() ? watch_args :
+        batch_command->was_invoked() ? batch_args : args;
+    auto pass_checks = parse_pass_checks(invoked_args.check_passes);
+    if (!pass_checks) {
+        std::cout << TTY_RED << "Invalid value " << invoked_args.check_passes << " for -check_passes, expected full, changed, sampled or debug" <<
+            TTY_RESET << std::endl;
+        return 1;
+    }
 
-        pm.run_pass<simplify_transition_ifs>();
-        pm.run_pass<semantic_checker>();
-        DEBUG(std::cout << TTY_CYAN << "simplify_transition_ifs" << TTY_RESET << std::endl);
-        DEBUG(std::cout << pp.get_output() << std::endl);
+    if (serve->was_invoked()) {
+        auto server_opts = server::options();
+        server_opts.socket_path = socket_path;
+        set_compile_options(server_opts, serve_args, *pass_checks);
+        if (!server(server_opts).run()) {
+            std::cout << TTY_RED << "Could not listen on socket " << socket_path << TTY_RESET << std::endl;
+            return 1;
+        }
+        return 0;
+    }
 
-        pm.run_pass<collapse_traits>();
-        pm.run_pass<semantic_checker>();
-        DEBUG(std::cout << TTY_CYAN << "collapse_traits" << TTY_RESET << std::endl);
-        DEBUG(std::cout << pp.get_output() << std::endl);
+    if (watch->was_invoked()) {
+        auto watcher_opts = watcher::options();
+        watcher_opts.input_files = split_files(watch_more_input_files);
+        watcher_opts.input_files.insert(watcher_opts.input_files.begin(), watch_input_file);
+        set_compile_options(watcher_opts, watch_args, *pass_checks);
+        watcher_opts.debounce = std::chrono::milliseconds(std::max(debounce, 0));
+        if (!watcher(watcher_opts).run()) {
+            std::cout << TTY_RED << "Could not watch " << watch_input_file << " for changes" << TTY_RESET << std::endl;
+            return 1;
+        }
+        return 0;
+    }
 
-        pm.run_pass<merge_ifs>();
-        pm.run_pass<semantic_checker>();
-        DEBUG(std::cout << TTY_CYAN << "merge_ifs" << TTY_RESET << std::endl);
-        DEBUG(std::cout << pp.get_output() << std::endl);
+    if (batch_command->was_invoked()) {
+        auto batch_opts = batch::options();
+        if (!manifest_file.empty()) {
+            auto maps = batch::read_manifest(manifest_file);
+            if (!maps) {
+                std::cout << TTY_RED << manifest_file << ": Could not read manifest file" << TTY_RESET << std::endl;
+                return 1;
+            }
+            batch_opts.maps = std::move(*maps);
+        }
+        for (auto& file : split_files(batch_maps)) {
+            batch_opts.maps.push_back({file});
+        }
+        if (batch_opts.maps.empty()) {
+            std::cout << TTY_RED << "No maps to compile, expected -manifest or -maps" << TTY_RESET << std::endl;
+            return 1;
+        }
+        set_compile_options(batch_opts, batch_args, *pass_checks);
+        return batch(batch_opts).run() ? 0 : 1;
+    }
 
-        DEBUG(std::cout << TTY_CYAN << "assign_variables" << TTY_RESET << std::endl);
-        pm.run_pass<assign_variables>();
-        DEBUG(std::cout << std::endl);
+    auto opts = glc::options();
+    for (auto& file : split_files(more_input_files)) {
+        opts.more_sources.push_back({file});
+    }
+    set_compile_options(opts, args, *pass_checks);
 
-        std::cout << TTY_GREEN << "Compilation succeeded" << TTY_RESET << std::endl;
-    } catch (vector<string>& errors) {
-        for (auto& error : errors) {
+    auto result = glc::compile({input_file}, opts);
+    if (!result.success) {
+        for (auto& error : result.errors) {
             std::cout << error << std::endl;
         }
-        std::cout << TTY_RED << "Compilation failed due to at least " << errors.size() <<
-            (errors.size() == 1 ? " error" : " errors") << TTY_RESET << std::endl;
+        std::cout << TTY_RED << "Compilation failed due to at least " << result.errors.size() <<
+            (result.errors.size() == 1 ? " error" : " errors") << TTY_RESET << std::endl;
         return 1;
     }
 
+    if (args.maude_check) {
+        std::cout << "Maude memo: " << result.memo_hits << " hits, " << result.memo_misses << " misses" << std::endl;
+    }
+    std::cout << TTY_GREEN << "Compilation succeeded" << TTY_RESET << std::endl;
     return 0;
 }
@@ -1,76 +1,381 @@
 #include "maude.h"
+#include "hash.h"
 
 #include <cstdlib>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using std::string;
 using std::function;
 using std::tuple;
 using std::make_tuple;
 using std::optional;
+using std::vector;
+
+using steady_clock = std::chrono::steady_clock;
+
+// Prompt printed by Maude in interactive mode once it is ready to read the next command
+static auto const prompt = string("Maude> ");
+
+// Each record in the memo file is a single line of the form
+//   <module hash in hex>\t<expression>\t<sort>\t<result>\n
+// so that records can be appended independently and a partially written record at the end is ignored
+maude_memo::maude_memo(string module, string filename) {
+	std::ifstream module_file(module);
+	std::stringstream module_contents;
+	module_contents << module_file.rdbuf();
+	char hash_text[17];
+	snprintf(hash_text, sizeof(hash_text), "%016llx", static_cast<unsigned long long>(hash::fnv1a(module_contents.str())));
+	module_key = hash_text;
+
+	if (!filename.empty()) {
+		auto ends_with_newline = load(filename);
+		fd = open(filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+		// Terminate a record left partially written by an interrupted compile so that it does not corrupt ours
+		if (fd >= 0 && !ends_with_newline && write(fd, "\n", 1) != 1) {
+			close(fd);
+			fd = -1;
+		}
+	}
+}
+
+maude_memo::~maude_memo() {
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+auto maude_memo::load(string const& filename) -> bool {
+	auto file = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (file < 0) {
+		return true;
+	}
+
+	struct stat file_stat;
+	if (fstat(file, &file_stat) != 0 || file_stat.st_size == 0) {
+		close(file);
+		return true;
+	}
+
+	auto size = static_cast<size_t>(file_stat.st_size);
+	auto mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (mapping == MAP_FAILED) {
+		return true;
+	}
+
+	auto contents = std::string_view(static_cast<char const*>(mapping), size);
+	for (size_t line_start = 0; line_start < contents.size();) {
+		auto line_end = contents.find('\n', line_start);
+		if (line_end == std::string_view::npos) {
+			break;
+		}
+		auto line = contents.substr(line_start, line_end - line_start);
+		line_start = line_end + 1;
+
+		// Split the record into its four fields, skipping records for other versions of the module
+		auto tab_1 = line.find('\t');
+		auto tab_2 = line.find('\t', tab_1 + 1);
+		auto tab_3 = line.find('\t', tab_2 + 1);
+		if (tab_1 == std::string_view::npos || tab_2 == std::string_view::npos || tab_3 == std::string_view::npos ||
+			line.substr(0, tab_1) != module_key)
+		{
+			continue;
+		}
+
+		entries[string(line.substr(tab_1 + 1, tab_2 - tab_1 - 1))] = make_tuple(
+			string(line.substr(tab_2 + 1, tab_3 - tab_2 - 1)), string(line.substr(tab_3 + 1)));
+	}
+
+	auto ends_with_newline = contents.back() == '\n';
+	munmap(mapping, size);
+	return ends_with_newline;
+}
+
+auto maude_memo::lookup(string const& expr) -> optional<result> {
+	auto guard = std::lock_guard(lock);
+	auto it = entries.find(expr);
+	if (it == entries.end()) {
+		num_misses++;
+		return std::nullopt;
+	}
+	num_hits++;
+	return it->second;
+}
+
+void maude_memo::insert(string const& expr, result const& value) {
+	auto guard = std::lock_guard(lock);
+	entries[expr] = value;
+
+	auto& [sort, reduced] = value;
+	auto fits_on_line = [] (string const& s) { return s.find_first_of("\t\n") == string::npos; };
+	if (fd < 0 || !fits_on_line(expr) || !fits_on_line(sort) || !fits_on_line(reduced)) {
+		return;
+	}
+
+	// Written with a single call so that concurrent compiles appending to the same file do not interleave records
+	auto record = module_key + "\t" + expr + "\t" + sort + "\t" + reduced + "\n";
+	if (write(fd, record.data(), record.length()) != static_cast<ssize_t>(record.length())) {
+		// Stop persisting if the file cannot be written, but keep the in-memory cache
+		close(fd);
+		fd = -1;
+	}
+}
+
+maude::~maude() {
+	stop();
+}
+
+// Parses a line with format result <sort>: <expression>
+static auto parse_result(string const& line) -> optional<tuple<string, string>> {
+	if (line.substr(0, 7) != "result ") {
+		return std::nullopt;
+	}
+
+	auto colon_pos = line.find_first_of(':');
+	if (colon_pos == string::npos) {
+		return std::nullopt;
+	}
+
+	return make_tuple(line.substr(7, colon_pos - 7), line.substr(colon_pos + 2));
+}
 
 auto maude::reduce(string expr) -> optional<tuple<string, string>> {
-	bool got_result = false;
-	string sort;
-	string result;
-
-	run_command("echo \"red " + expr + " .\" | ./maude 2>&1 " + module,
-		[&] (string line) {
-			// Parse a string with format result <sort>: <expression>
-			if (line.substr(0, 6) != "result") {
-				return;
-			}
+	return reduce_batch({expr})[0];
+}
+
+auto maude::reduce_batch(vector<string> const& exprs) -> vector<optional<tuple<string, string>>> {
+	auto results = vector<optional<tuple<string, string>>>(exprs.size());
 
-			auto colon_pos = line.find_first_of(':');
-			if (colon_pos == string::npos) {
-				return;
+	// Only the expressions that have not been memoized are sent to Maude
+	auto to_send = vector<size_t>();
+	for (size_t i = 0; i < exprs.size(); i++) {
+		if (memo) {
+			if (auto cached = memo->lookup(exprs[i])) {
+				results[i] = cached;
+				continue;
 			}
+		}
+		to_send.push_back(i);
+	}
 
-			got_result = true;
-			sort = line.substr(7, colon_pos);
-			result = line.substr(colon_pos + 2);
+	// If Maude dies or hangs, restart it and resend the commands that were not answered
+	// A command that was in flight during two failures in a row is given up on, so that one bad
+	//  expression does not cause the rest of the batch to fail
+	size_t answered = 0;
+	auto failed_attempts = 0;
+	while (answered < to_send.size()) {
+		auto first = answered;
+		auto commands = vector<string>();
+		for (auto i = first; i < to_send.size(); i++) {
+			commands.push_back("red " + exprs[to_send[i]] + " .");
+		}
+
+		auto newly_answered = run_commands(commands, [&] (size_t command, string line) {
+			if (auto result = parse_result(line)) {
+				results[to_send[first + command]] = result;
+			}
 		});
+		answered += newly_answered;
+		if (answered == to_send.size()) {
+			break;
+		}
 
-	if (got_result) {
-		return make_tuple(sort, result);
-	} else {
-		return std::nullopt;
+		stop();
+		failed_attempts = newly_answered > 0 ? 1 : failed_attempts + 1;
+		if (failed_attempts == 2) {
+			results[to_send[answered]] = std::nullopt;
+			answered++;
+			failed_attempts = 0;
+		}
 	}
+
+	if (memo) {
+		for (auto i : to_send) {
+			if (results[i]) {
+				memo->insert(exprs[i], results[i].value());
+			}
+		}
+	}
+
+	return results;
+}
+
+auto maude::start() -> bool {
+	if (pid > 0) {
+		return true;
+	}
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		return false;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+
+	if (pid == 0) {
+		// Connect stdin, stdout, and stderr of Maude to our end of the channel
+		dup2(fds[1], STDIN_FILENO);
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		execl("./maude", "maude", "-interactive", "-no-tecla", "-no-banner", "-no-wrap", "-no-advise",
+			module.c_str(), static_cast<char*>(nullptr));
+		_exit(127);
+	}
+
+	close(fds[1]);
+	channel = fds[0];
+	pending.clear();
+
+	// Wait for the module to finish loading, which is signalled by the first prompt
+	if (exchange("", 1, [] (size_t _, string __) {}) != 1) {
+		stop();
+		return false;
+	}
+	return true;
+}
+
+void maude::stop() {
+	if (channel >= 0) {
+		close(channel);
+		channel = -1;
+	}
+	if (pid > 0) {
+		kill(pid, SIGKILL);
+		waitpid(pid, nullptr, 0);
+		pid = -1;
+	}
+	pending.clear();
+}
+
+auto maude::run_commands(vector<string> const& commands, function<void(size_t, string)> callback) -> size_t {
+	if (!start()) {
+		return 0;
+	}
+
+	auto request = string();
+	for (auto& command : commands) {
+		request += command + "\n";
+	}
+	return exchange(request, commands.size(), callback);
 }
 
-auto maude::run_command(string command, function<void(string)> callback) -> bool {
-    char buffer[1024];
-    FILE *stream = popen(command.c_str(), "r");
-
-    if (!stream) {
-    	return false;
-    }
-
-    string cur_line = "";
-    while (!feof(stream)) {
-        size_t bytes_read = fread(static_cast<void*>(buffer), 1, 1024, stream);
-        if (bytes_read != 1024 && (!feof(stream) || bytes_read == 0)) {
-        	return false;
-        }
-
-        cur_line += string(buffer, bytes_read);
-
-        while (true) {
-            int newline_pos = -1;
-            for (size_t i = 0; i < cur_line.length(); i++) {
-                if (cur_line.at(i) == '\n') {
-                    newline_pos = i;
-                    break;
-                }
-            }
-
-            // Check if we encountered a \n, which means we should call the callback
-            if (newline_pos < 0) {
-            	break;
-            }
-
-            callback(cur_line.substr(0, newline_pos));
-            cur_line = cur_line.substr(newline_pos + 1);
-        }
-    }
-    return pclose(stream) == 0;
-}
\ No newline at end of file
+auto maude::exchange(string const& request, size_t num_responses, function<void(size_t, string)> callback) -> size_t {
+	char buffer[4096];
+	size_t written = 0;
+	size_t completed = 0;
+	auto deadline = steady_clock::now() + timeout;
+
+	while (completed < num_responses) {
+		// Consume all complete lines and prompts that have been read so far
+		// Maude prints a prompt without a trailing newline right before reading each command, so the
+		//  response to the next command starts immediately after it
+		while (completed < num_responses) {
+			if (pending.compare(0, prompt.length(), prompt) == 0) {
+				pending.erase(0, prompt.length());
+				completed++;
+				deadline = steady_clock::now() + timeout;
+				continue;
+			}
+
+			auto newline_pos = pending.find('\n');
+			if (newline_pos == string::npos) {
+				break;
+			}
+			callback(completed, pending.substr(0, newline_pos));
+			pending.erase(0, newline_pos + 1);
+		}
+		if (completed == num_responses) {
+			break;
+		}
+
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - steady_clock::now());
+		if (remaining.count() <= 0) {
+			return completed;
+		}
+
+		// Keep reading while writing so that neither side blocks on a full buffer during a large batch
+		auto pfd = pollfd { channel, static_cast<short>(written < request.length() ? POLLIN | POLLOUT : POLLIN), 0 };
+		auto ready = poll(&pfd, 1, remaining.count());
+		if (ready < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ready <= 0) {
+			return completed;
+		}
+
+		if (pfd.revents & POLLOUT) {
+			auto result = send(channel, request.data() + written, request.length() - written, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+				return completed;
+			}
+			if (result > 0) {
+				written += result;
+			}
+		}
+
+		if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+			auto bytes_read = read(channel, buffer, sizeof(buffer));
+			if (bytes_read < 0 && errno == EINTR) {
+				continue;
+			}
+			if (bytes_read <= 0) {
+				// Maude exited
+				return completed;
+			}
+			pending.append(buffer, bytes_read);
+		}
+	}
+
+	return completed;
+}
+
+auto maude_pool::acquire() -> std::unique_ptr<maude> {
+	auto guard = std::lock_guard(lock);
+	if (idle.empty()) {
+		return std::make_unique<maude>(module, memo);
+	}
+	auto session = std::move(idle.back());
+	idle.pop_back();
+	return session;
+}
+
+void maude_pool::release(std::unique_ptr<maude> session) {
+	auto guard = std::lock_guard(lock);
+	idle.push_back(std::move(session));
+}
+
+void maude_pool::start(size_t count) {
+	auto sessions = vector<std::unique_ptr<maude>>();
+	{
+		auto guard = std::lock_guard(lock);
+		while (idle.size() + sessions.size() < count) {
+			sessions.push_back(std::make_unique<maude>(module, memo));
+		}
+	}
+
+	// Started outside of the lock, since loading the module takes a while
+	for (auto& session : sessions) {
+		session->start();
+		release(std::move(session));
+	}
+}
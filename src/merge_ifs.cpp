@@ -3,58 +3,60 @@
 #include "visitor.h"
 #include "print_program.h"
 #include "maude.h"
+#include "normal_form.h"
+#include "thread_pool.h"
+#include "expr_table.h"
 
 #include <vector>
 #include <memory>
 #include <string>
 #include <cassert>
-#include <map>
-#include <set>
+#include <unordered_map>
+#include <algorithm>
+#include <optional>
 
 using std::vector;
 using std::unique_ptr;
 using std::make_unique;
 using std::string;
-using std::map;
-using std::set;
+using std::unordered_map;
+using std::optional;
 
 // Custom printer that will cause logical / arithmetic expressions to print according to the syntax in lwg.maude
 struct maude_printer {
-    auto operator()(print_program& pp, ast::arithmetic_value& v) -> string {
-        auto output = string();
-        std::visit(ast::overloaded {
-            [&] (unique_ptr<ast::field>& val) { output = pp.get_output_for_node<ast::field, maude_printer>(*val); },
-            [&] (long val) { output = std::to_string(val); },
-            [&] (double val) { output = std::to_string(val); }
-        }, v.value);
-        return output + ":Arithmetic";
-    }
-
-    auto operator()(print_program& pp, ast::logical& v) -> string {
-    	auto output = std::string("(");
+	void operator()(print_program& pp, print_sink& out, ast::arithmetic_value& v) {
+		std::visit(ast::overloaded {
+			[&] (unique_ptr<ast::field>& val) { pp.write_node<ast::field, maude_printer>(*val, out); },
+			[&] (long val) { out << val; },
+			[&] (double val) { out << val; }
+		}, v.value);
+		out << ":Arithmetic";
+	}
+
+	void operator()(print_program& pp, print_sink& out, ast::logical& v) {
+		out << "(";
 		std::visit([&] (auto& val) {
-			output += pp.get_output_for_node<decltype(*val), maude_printer>(*val);
+			pp.write_node<std::remove_reference_t<decltype(*val)>, maude_printer>(*val, out);
 		}, v.expr);
 		if (std::holds_alternative<unique_ptr<ast::field>>(v.expr) || std::holds_alternative<unique_ptr<ast::val_bool>>(v.expr)) {
-			output += ":Logical";
+			out << ":Logical";
+		}
+		out << ")";
+	}
+
+	void operator()(print_program& pp, print_sink& out, ast::comparison& v) {
+		pp.write_node<ast::arithmetic, maude_printer>(*v.lhs, out);
+		switch (v.comparison_type) {
+			case ast::comparison_enum::EQ: out << " eqs "; break;
+			case ast::comparison_enum::NEQ: out << " neq "; break;
+			case ast::comparison_enum::GT: out << " gt "; break;
+			case ast::comparison_enum::LT: out << " lt "; break;
+			case ast::comparison_enum::GTE: out << " gte "; break;
+			case ast::comparison_enum::LTE: out << " lte "; break;
+			default: assert(false);
 		}
-		output += ")";
-		return output;
-    }
-
-    auto operator()(print_program& pp, ast::comparison& v) -> string {
-    	auto lhs = pp.get_output_for_node<ast::arithmetic, maude_printer>(*v.lhs);
-    	auto rhs = pp.get_output_for_node<ast::arithmetic, maude_printer>(*v.rhs);
-    	switch (v.comparison_type) {
-    		case ast::comparison_enum::EQ: return lhs + " eqs " + rhs;
-    		case ast::comparison_enum::NEQ: return lhs + " neq " + rhs;
-    		case ast::comparison_enum::GT: return lhs + " gt " + rhs;
-    		case ast::comparison_enum::LT: return lhs + " lt " + rhs;
-    		case ast::comparison_enum::GTE: return lhs + " gte " + rhs;
-    		case ast::comparison_enum::LTE: return lhs + " lte " + rhs;
-    		default: assert(false);
-    	}
-    }
+		pp.write_node<ast::arithmetic, maude_printer>(*v.rhs, out);
+	}
 };
 
 struct merge_nested_ifs_visitor {
@@ -76,33 +78,35 @@ struct merge_nested_ifs_visitor {
 	//  if (condition 1) { ... }
 	//
 	// where common or redundantly generated if statements will be merged or removed by another pass
+	// The original if statement is discarded afterwards, so its children are moved rather than cloned, and
+	//  only its condition is copied once for every child if statement
 	auto merge_if(ast::continuous_if& n) -> vector<unique_ptr<ast::continuous_if>> {
 		using namespace ast;
 
 		auto new_ifs = vector<unique_ptr<continuous_if>>();
 
-		// If statement with the same condition as the original if statement that will
+		// Body of an if statement with the same condition as the original if statement that will
 		//  contain all the non-if statements from the original if body that do not need merging
-		auto main_if = continuous_if::make(n.condition->clone(), make_unique<always_body>());
+		auto main_body = make_unique<always_body>();
 
 		for (auto& expr : n.body->exprs) {
 			std::visit(overloaded {
 				[&] (unique_ptr<continuous_if>& child) {
 					// Create a new if statement merging with this child
 					auto merged = continuous_if::make(
-						logical::make(and_op::make(n.condition->clone(), child->condition->clone())),
-						child->body->clone()
+						logical::make(and_op::make(n.condition->clone(), std::move(child->condition))),
+						std::move(child->body)
 					);
 					new_ifs.push_back(std::move(merged));
 				},
 				[&] (auto& child) {
 					// Append the line to the main if statement body
-					main_if->body->insert_expr(child->clone());
+					main_body->insert_expr(std::move(child));
 				}
 			}, expr);
 		}
 
-		new_ifs.emplace_back(std::move(main_if));
+		new_ifs.emplace_back(continuous_if::make(std::move(n.condition), std::move(main_body)));
 		return new_ifs;
 	}
 
@@ -112,6 +116,16 @@ struct merge_nested_ifs_visitor {
 			// Merge if statements, and leave all other statements alone
 			std::visit(ast::overloaded {
 				[&] (unique_ptr<ast::continuous_if>& child) {
+					// If statements without nested if statements are kept as they are, so that the semantic checker
+					//  does not consider them changed
+					auto has_nested_if = std::any_of(child->body->exprs.begin(), child->body->exprs.end(), [] (auto& e) {
+						return std::holds_alternative<unique_ptr<ast::continuous_if>>(e);
+					});
+					if (!has_nested_if) {
+						new_exprs.emplace_back(std::move(child));
+						return;
+					}
+
 					for (auto& if_stmt : merge_if(*child)) {
 						ast::set_parent(&n, if_stmt);
 						new_exprs.emplace_back(std::move(if_stmt));
@@ -148,18 +162,175 @@ struct remove_empty_ifs_visitor {
 	}
 };
 
+// Disjoint sets over the indices [0, size), where the smallest index in each set is its representative
+struct disjoint_sets {
+	vector<size_t> parents;
+
+	disjoint_sets(size_t size) : parents(size) {
+		for (size_t i = 0; i < size; i++) {
+			parents[i] = i;
+		}
+	}
+
+	auto find(size_t i) -> size_t {
+		while (parents[i] != i) {
+			parents[i] = parents[parents[i]];
+			i = parents[i];
+		}
+		return i;
+	}
+
+	void merge(size_t i, size_t j) {
+		i = find(i);
+		j = find(j);
+		if (i != j) {
+			parents[std::max(i, j)] = std::min(i, j);
+		}
+	}
+};
+
+// Collects the condition of every if statement
+// Merging only moves existing if statements around, so these are all the conditions that will ever be compared
+struct collect_conditions_visitor {
+	vector<ast::logical*> conditions;
+
+	void operator()(ast::continuous_if& n) {
+		conditions.push_back(n.condition.get());
+	}
+};
+
+// Everything needed to compare the conditions of the program, computed up front so that the work can be
+//  spread over several threads while the merges themselves are still applied in a fixed order
+// Structurally identical conditions share an index, so each distinct condition is only canonicalized once
+struct condition_keys {
+	unordered_map<ast::logical*, size_t> index_of;
+	vector<optional<normal_form>> normal_forms;
+	// Conditions printed in the syntax of lwg.maude and their reduced forms, only filled in when checking with Maude
+	vector<string> maude_texts;
+	vector<optional<string>> reduced;
+
+	auto normal_form_of(ast::logical& condition) -> normal_form const& {
+		return normal_forms[index_of.at(&condition)].value();
+	}
+
+	auto maude_text_of(ast::logical& condition) -> string const& {
+		return maude_texts[index_of.at(&condition)];
+	}
+
+	auto reduced_of(ast::logical& condition) -> optional<string> const& {
+		return reduced[index_of.at(&condition)];
+	}
+};
+
+// Number of conditions handled by one task, which for Maude is also the number of reductions sent in one batch
+static constexpr size_t conditions_per_task = 32;
+
+template <typename Root>
+static auto compute_condition_keys(ast::program& program, Root& root, merge_ifs::options const& opts) -> condition_keys {
+	auto ccv = collect_conditions_visitor();
+	visit<Root, decltype(ccv)>()(root, ccv);
+
+	// Only the first of each group of structurally identical conditions needs to be canonicalized
+	auto keys = condition_keys();
+	auto table = expr_table();
+	auto index_of_id = unordered_map<expr_table::expr_id, size_t>();
+	auto distinct = vector<ast::logical*>();
+	for (auto condition : ccv.conditions) {
+		auto [it, inserted] = index_of_id.emplace(table.intern(*condition), distinct.size());
+		if (inserted) {
+			distinct.push_back(condition);
+		}
+		keys.index_of[condition] = it->second;
+	}
+
+	keys.normal_forms.resize(distinct.size());
+	if (opts.maude_check) {
+		auto pp = print_program(program);
+		for (auto condition : distinct) {
+			keys.maude_texts.push_back(pp.get_output_for_node<ast::logical, maude_printer>(*condition));
+		}
+		keys.reduced.resize(distinct.size());
+	}
+
+	auto own_pool = optional<thread_pool>();
+	auto& pool = opts.workers ? *opts.workers : own_pool.emplace(opts.jobs);
+	// Each worker has its own Maude process, started the first time that worker needs it
+	auto sessions = vector<unique_ptr<maude>>(pool.size());
+
+	for (size_t start = 0; start < distinct.size(); start += conditions_per_task) {
+		auto end = std::min(start + conditions_per_task, distinct.size());
+		pool.submit([&, start, end] (unsigned worker) {
+			for (auto i = start; i < end; i++) {
+				keys.normal_forms[i] = normal_form::of(*distinct[i]);
+			}
+		});
+	}
+
+	for (size_t start = 0; start < keys.maude_texts.size(); start += conditions_per_task) {
+		auto end = std::min(start + conditions_per_task, keys.maude_texts.size());
+		pool.submit([&, start, end] (unsigned worker) {
+			if (!sessions[worker]) {
+				sessions[worker] = opts.maude_processes ? opts.maude_processes->acquire() : make_unique<maude>("lwg.maude", opts.memo);
+			}
+
+			auto batch = vector<string>(keys.maude_texts.begin() + start, keys.maude_texts.begin() + end);
+			auto results = sessions[worker]->reduce_batch(batch);
+			for (auto i = start; i < end; i++) {
+				if (auto& result = results[i - start]) {
+					keys.reduced[i] = std::get<1>(result.value());
+				}
+			}
+		});
+	}
+
+	pool.wait();
+	if (opts.maude_processes) {
+		for (auto& session : sessions) {
+			if (session) {
+				opts.maude_processes->release(std::move(session));
+			}
+		}
+	}
+	return keys;
+}
+
 struct merge_common_ifs_visitor {
 	// Merges if statements that have the same condition in the same always_body
 
 	ast::program& program;
-	bool changed;
+	// Whether equivalences decided using normal forms should be cross-checked with Maude
+	bool maude_check;
+	condition_keys& keys;
+
+	merge_common_ifs_visitor(ast::program& program, bool maude_check, condition_keys& keys)
+		: program(program), maude_check(maude_check), keys(keys) {}
+
+	// Reports any pair of conditions where the grouping by Maude's reduced form does not match the
+	//  grouping by our own normal form
+	void check_with_maude(vector<unique_ptr<ast::continuous_if>>& if_stmts, disjoint_sets& groups) {
+		// Maps Maude's reduced form of a condition to the group of the first condition with that reduced form
+		auto group_of_reduced = unordered_map<string, size_t>();
+		// Maps a group to the Maude reduced form of its first condition
+		auto reduced_of_group = unordered_map<size_t, string>();
+
+		for (size_t i = 0; i < if_stmts.size(); i++) {
+			auto& cond = keys.maude_text_of(*if_stmts[i]->condition);
+			auto& reduced = keys.reduced_of(*if_stmts[i]->condition);
+			if (!reduced) {
+				std::cerr << "Unexpected internal failure of Maude on expression: " + cond << std::endl;
+				continue;
+			}
 
-	merge_common_ifs_visitor(ast::program& program) : program(program), changed(false) {}
+			auto group = groups.find(i);
+			auto [group_it, new_reduced] = group_of_reduced.emplace(reduced.value(), group);
+			auto [reduced_it, new_group] = reduced_of_group.emplace(group, reduced.value());
+			if (group_it->second != group || reduced_it->second != reduced.value()) {
+				std::cerr << "Maude disagrees with the normal form on the grouping of expression: " + cond << std::endl;
+			}
+		}
+	}
 
 	void operator()(ast::always_body& n) {
-		auto pp = print_program(program);
-		auto maude_inst = maude("lwg.maude");
-
 		// Collect all if statements in a separate vector
 		auto if_stmts = vector<unique_ptr<ast::continuous_if>>();
 		for (auto it = n.exprs.begin(); it != n.exprs.end();) {
@@ -172,101 +343,81 @@ struct merge_common_ifs_visitor {
 			}
 		}
 
-		// Create disjoint sets of if statements that have equivalent conditions that can be merged
-		// Map from if_stmt index to set index
-		auto set_map = map<size_t, size_t>();
-		// Map from set index to if stmt indices
-		auto stmt_map = map<size_t, set<size_t>>();
-		auto cur_set_index = 0;
-		for (auto i = 0U; i < if_stmts.size(); i++) {
-			for (auto j = i + 1; j < if_stmts.size(); j++) {
-				// Check if the two are already transitively equivalent and skip if so
-				if (set_map.find(i) != set_map.end() && set_map.find(j) != set_map.end() && set_map[i] == set_map[j]) {
-					continue;
-				}
-
-				// Check if the two conditions are equivalent
-				auto cond_1 = pp.get_output_for_node<ast::logical, maude_printer>(*if_stmts[i]->condition);
-				auto cond_2 = pp.get_output_for_node<ast::logical, maude_printer>(*if_stmts[j]->condition);
-				auto result = maude_inst.reduce(cond_1 + " == " + cond_2);
-
-				if (!result) {
-					std::cerr << "Unexpected internal failure of Maude on expression: " + cond_1 + " == " + cond_2 << std::endl;
-				}
-				if (!result || std::get<1>(result.value()) != "true") {
-					continue;
-				}
-
-				// Create a new set if neither of them is in one already
-				if (set_map.find(i) == set_map.end() && set_map.find(j) == set_map.end()) {
-					set_map[i] = cur_set_index;
-					set_map[j] = cur_set_index;
-					stmt_map[cur_set_index].insert(i);
-					stmt_map[cur_set_index].insert(j);
-					cur_set_index++;
-					continue;
-				}
-
-				// Find the index of the set that one is already in
-				auto set_index = set_map.find(i) == set_map.end() ? set_map[j] : set_map[i];
-				// Insert both into the set (one redundantly)
-				set_map[i] = set_index;
-				set_map[j] = set_index;
-				stmt_map[set_index].insert(i);
-				stmt_map[set_index].insert(j);
+		// Group if statements whose conditions have the same normal form, and can therefore be merged
+		auto groups = disjoint_sets(if_stmts.size());
+		auto first_with_normal_form = unordered_map<normal_form, size_t>();
+		for (size_t i = 0; i < if_stmts.size(); i++) {
+			auto [it, inserted] = first_with_normal_form.emplace(keys.normal_form_of(*if_stmts[i]->condition), i);
+			if (!inserted) {
+				groups.merge(it->second, i);
 			}
 		}
 
-		auto merged_if_stmts = vector<unique_ptr<ast::continuous_if>>();
-		for (auto& it : stmt_map) {
-			auto& if_stmt_indices = it.second;
-
-			// Copy the condition of the first if statement of the list into the new if statement
-			auto& first_if = if_stmts[*if_stmt_indices.begin()];
-			auto new_if_stmt = ast::continuous_if::make(std::move(first_if->condition), make_unique<ast::always_body>());
-
-			// Move each if statement out of the vector if_stmts and append the body into the new if statement
-			for (auto i : if_stmt_indices) {
-				auto cur_if = std::move(if_stmts[i]);
+		if (maude_check) {
+			check_with_maude(if_stmts, groups);
+		}
 
-				for (auto& expr : cur_if->body->exprs) {
-					new_if_stmt->body->insert_expr(std::move(expr));
-				}
+		// Move the bodies of all if statements in a group into the first if statement of the group
+		auto is_merged = vector<bool>(if_stmts.size(), false);
+		for (size_t i = 0; i < if_stmts.size(); i++) {
+			auto first = groups.find(i);
+			if (first == i) {
+				continue;
 			}
 
-			merged_if_stmts.emplace_back(std::move(new_if_stmt));
+			is_merged[first] = true;
+			for (auto& expr : if_stmts[i]->body->exprs) {
+				if_stmts[first]->body->insert_expr(std::move(expr));
+			}
+			if_stmts[i].reset();
 		}
 
-		if (merged_if_stmts.size() > 0) {
-			changed = true;
+		// Bodies were already visited, so only a merged body can contain if statements that are now mergeable
+		for (size_t i = 0; i < if_stmts.size(); i++) {
+			if (is_merged[i]) {
+				(*this)(*if_stmts[i]->body);
+			}
 		}
 
-		// Insert the new if statements back into the original body
-		// First, the if statements that were not merged
-		for (auto& if_stmt : if_stmts) {
-			// May be nullptr since we moved if statements out while merging
-			if (if_stmt) {
-				n.insert_expr(std::move(if_stmt));
+		// Insert the if statements back into the original body
+		// First, the if statements that were not merged, and then the merged ones
+		for (size_t i = 0; i < if_stmts.size(); i++) {
+			if (if_stmts[i] && !is_merged[i]) {
+				n.insert_expr(std::move(if_stmts[i]));
 			}
 		}
-		for (auto& if_stmt : merged_if_stmts) {
-			n.insert_expr(std::move(if_stmt));
+		for (size_t i = 0; i < if_stmts.size(); i++) {
+			if (is_merged[i]) {
+				n.insert_expr(std::move(if_stmts[i]));
+			}
 		}
 	}
 };
 
 merge_ifs::merge_ifs(pass_manager& pm)
-	: program(*pm.get_pass<parser>()->program)
-{
-	auto mniv = merge_nested_ifs_visitor(program);
-	visit<ast::program, decltype(mniv)>()(program, mniv);
+	: merge_ifs(pm, options()) {}
 
+// Merges the if statements within root, which is either the whole program or a part of it
+template <typename Root>
+static void merge_all(ast::program& program, Root& root, merge_ifs::options const& opts) {
+	// Both visitors only change the body they are visiting, and bodies are visited after everything nested in them,
+	//  so removing empty ifs from each body right after flattening it gives the same result as two separate walks
+	auto mniv = merge_nested_ifs_visitor(program);
 	auto reiv = remove_empty_ifs_visitor(program);
-	visit<ast::program, decltype(reiv)>()(program, reiv);
+	auto flatten = visitor_pack(mniv, reiv);
+	visit<Root, decltype(flatten)>()(root, flatten);
+
+	auto keys = compute_condition_keys(program, root, opts);
+	auto mciv = merge_common_ifs_visitor(program, opts.maude_check, keys);
+	visit<Root, decltype(mciv)>()(root, mciv);
+}
+
+merge_ifs::merge_ifs(pass_manager& pm, options opts)
+	: program(*pm.get_pass<parser>()->program)
+{
+	merge_all(program, program, opts);
+}
 
-	auto mciv = merge_common_ifs_visitor(program);
-	do {
-		mciv.changed = false;
-		visit<ast::program, decltype(mciv)>()(program, mciv);
-	} while (mciv.changed);
+void merge_ifs::merge_trait(ast::program& program, ast::trait& trait, options const& opts) {
+	merge_all(program, trait, opts);
 }
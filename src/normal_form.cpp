@@ -0,0 +1,300 @@
+#include "normal_form.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <memory>
+#include <variant>
+#include <cassert>
+
+using std::string;
+using std::vector;
+using std::unique_ptr;
+using std::make_shared;
+
+// Implements the equations of lwg.maude as smart constructors, so that every term that is built is already in
+//  normal form as long as its arguments are
+struct normal_form_builder {
+	using op = normal_form::op;
+	using term = normal_form::term;
+	using term_ptr = normal_form::term_ptr;
+
+	static auto make(op kind, string atom, vector<term_ptr>&& args) -> term_ptr {
+		auto result = hash::combine(hash::fnv_offset_basis, static_cast<uint64_t>(kind));
+		result = hash::fnv1a(atom, result);
+		for (auto& arg : args) {
+			result = hash::combine(result, arg->hash);
+		}
+		return make_shared<term const>(term {kind, std::move(atom), std::move(args), result});
+	}
+
+	// Total order over terms used to sort the operands of commutative operators
+	// Terms are ordered by hash first so that comparisons rarely need to recurse
+	static auto compare(term const& a, term const& b) -> int {
+		if (&a == &b) {
+			return 0;
+		}
+		if (a.hash != b.hash) {
+			return a.hash < b.hash ? -1 : 1;
+		}
+		if (a.kind != b.kind) {
+			return a.kind < b.kind ? -1 : 1;
+		}
+		if (auto atom_cmp = a.atom.compare(b.atom); atom_cmp != 0) {
+			return atom_cmp;
+		}
+		if (a.args.size() != b.args.size()) {
+			return a.args.size() < b.args.size() ? -1 : 1;
+		}
+		for (size_t i = 0; i < a.args.size(); i++) {
+			if (auto arg_cmp = compare(*a.args[i], *b.args[i]); arg_cmp != 0) {
+				return arg_cmp;
+			}
+		}
+		return 0;
+	}
+
+	static auto atom(string name) -> term_ptr {
+		return make(op::ATOM, name, {});
+	}
+
+	// Flattens nested applications of an associative operator and sorts the operands since it is also commutative
+	static auto assoc_comm(op kind, vector<term_ptr> const& operands) -> term_ptr {
+		auto flattened = vector<term_ptr>();
+		for (auto& operand : operands) {
+			if (operand->kind == kind) {
+				flattened.insert(flattened.end(), operand->args.begin(), operand->args.end());
+			} else {
+				flattened.push_back(operand);
+			}
+		}
+		std::sort(flattened.begin(), flattened.end(), [] (term_ptr const& a, term_ptr const& b) {
+			return compare(*a, *b) < 0;
+		});
+		return make(kind, "", std::move(flattened));
+	}
+
+	static auto add(vector<term_ptr> const& operands) -> term_ptr {
+		return assoc_comm(op::ADD, operands);
+	}
+
+	// eq -(-(N)) = N .
+	static auto neg(term_ptr const& n) -> term_ptr {
+		if (n->kind == op::NEG) {
+			return n->args[0];
+		}
+		return make(op::NEG, "", {n});
+	}
+
+	// eq inv(inv(N)) = N .
+	static auto inv(term_ptr const& n) -> term_ptr {
+		if (n->kind == op::INV) {
+			return n->args[0];
+		}
+		return make(op::INV, "", {n});
+	}
+
+	// eq N * (- M) = -(N * M) .
+	// eq N * (M + J) = (N * M) + (N * J) .
+	static auto mul(vector<term_ptr> const& operands) -> term_ptr {
+		// Pull negations out of the product, flattening any products that were hidden beneath them
+		auto negate = false;
+		auto factors = vector<term_ptr>();
+		auto pending = vector<term_ptr>(operands.rbegin(), operands.rend());
+		while (!pending.empty()) {
+			auto factor = pending.back();
+			pending.pop_back();
+
+			if (factor->kind == op::NEG) {
+				negate = !negate;
+				pending.push_back(factor->args[0]);
+			} else if (factor->kind == op::MUL) {
+				pending.insert(pending.end(), factor->args.rbegin(), factor->args.rend());
+			} else {
+				factors.push_back(factor);
+			}
+		}
+
+		auto result = term_ptr();
+		auto sum = std::find_if(factors.begin(), factors.end(), [] (term_ptr const& t) { return t->kind == op::ADD; });
+		if (sum == factors.end()) {
+			result = assoc_comm(op::MUL, factors);
+		} else {
+			// Distribute the remaining factors over the first sum found
+			auto summands = (*sum)->args;
+			factors.erase(sum);
+
+			auto products = vector<term_ptr>();
+			for (auto& summand : summands) {
+				auto product_factors = factors;
+				product_factors.push_back(summand);
+				products.push_back(mul(product_factors));
+			}
+			result = add(products);
+		}
+
+		return negate ? neg(result) : result;
+	}
+
+	// eq N ^ (M + J) = (N ^ M) * (N ^ J) .
+	static auto exp(term_ptr const& base, term_ptr const& exponent) -> term_ptr {
+		if (exponent->kind != op::ADD) {
+			return make(op::EXP, "", {base, exponent});
+		}
+
+		auto factors = vector<term_ptr>();
+		for (auto& summand : exponent->args) {
+			factors.push_back(exp(base, summand));
+		}
+		return mul(factors);
+	}
+
+	// eq not(not(P)) = P .
+	// eq not (P and Q) = (not P) or (not Q) .
+	static auto negation(term_ptr const& p) -> term_ptr {
+		if (p->kind == op::NOT) {
+			return p->args[0];
+		}
+		if (p->kind == op::AND) {
+			auto negated_operands = vector<term_ptr>();
+			for (auto& operand : p->args) {
+				negated_operands.push_back(negation(operand));
+			}
+			return assoc_comm(op::OR, negated_operands);
+		}
+		return make(op::NOT, "", {p});
+	}
+
+	// eqs is commutative, but not associative
+	static auto eqs(term_ptr const& n, term_ptr const& m) -> term_ptr {
+		if (compare(*n, *m) <= 0) {
+			return make(op::EQS, "", {n, m});
+		} else {
+			return make(op::EQS, "", {m, n});
+		}
+	}
+
+	static auto lt(term_ptr const& n, term_ptr const& m) -> term_ptr {
+		return make(op::LT, "", {n, m});
+	}
+
+	// Produces the same text for a field as print_program, which is also what maude_printer sends to Maude
+	static auto field_text(ast::field& f) -> string {
+		auto output = string();
+		std::visit(ast::overloaded {
+			[&] (ast::this_unit _) { output = "this"; },
+			[&] (ast::type_unit _) { output = "type"; },
+			[&] (ast::identifier_unit u) { output = u.identifier; },
+		}, f.unit);
+		switch (f.member_op) {
+			case ast::member_op_enum::BUILTIN: output += "::"; break;
+			case ast::member_op_enum::CUSTOM: output += "."; break;
+			case ast::member_op_enum::LANGUAGE: output += "->"; break;
+			default: assert(false);
+		}
+		return output + f.field_name;
+	}
+
+	static auto from(ast::arithmetic& n) -> term_ptr {
+		auto result = term_ptr();
+		std::visit(ast::overloaded {
+			[&] (unique_ptr<ast::add>& v) { result = add({from(*v->expr_1), from(*v->expr_2)}); },
+			// eq N - M = N + ( - M ) .
+			[&] (unique_ptr<ast::sub>& v) { result = add({from(*v->expr_1), neg(from(*v->expr_2))}); },
+			[&] (unique_ptr<ast::mul>& v) { result = mul({from(*v->expr_1), from(*v->expr_2)}); },
+			// eq N / M = N * inv M .
+			[&] (unique_ptr<ast::div>& v) { result = mul({from(*v->expr_1), inv(from(*v->expr_2))}); },
+			[&] (unique_ptr<ast::mod>& v) { result = make(op::MOD, "", {from(*v->expr_1), from(*v->expr_2)}); },
+			[&] (unique_ptr<ast::exp>& v) { result = exp(from(*v->expr_1), from(*v->expr_2)); },
+			[&] (unique_ptr<ast::arithmetic_value>& v) {
+				std::visit(ast::overloaded {
+					[&] (unique_ptr<ast::field>& val) { result = atom(field_text(*val) + ":Arithmetic"); },
+					[&] (long val) { result = atom(std::to_string(val) + ":Arithmetic"); },
+					[&] (double val) { result = atom(std::to_string(val) + ":Arithmetic"); }
+				}, v->value);
+			}
+		}, n.expr);
+		return result;
+	}
+
+	static auto from(ast::comparison& n) -> term_ptr {
+		auto lhs = from(*n.lhs);
+		auto rhs = from(*n.rhs);
+		switch (n.comparison_type) {
+			case ast::comparison_enum::EQ: return eqs(lhs, rhs);
+			// eq N neq M = not (N == M) .
+			case ast::comparison_enum::NEQ: return negation(eqs(lhs, rhs));
+			// eq N gt M = M lt N .
+			case ast::comparison_enum::GT: return lt(rhs, lhs);
+			case ast::comparison_enum::LT: return lt(lhs, rhs);
+			// eq N gte M = not (N lt M) .
+			case ast::comparison_enum::GTE: return negation(lt(lhs, rhs));
+			// eq N lte M = not (M lt N) .
+			case ast::comparison_enum::LTE: return negation(lt(rhs, lhs));
+			default: assert(false);
+		}
+	}
+
+	static auto from(ast::logical& n) -> term_ptr {
+		auto result = term_ptr();
+		std::visit(ast::overloaded {
+			[&] (unique_ptr<ast::and_op>& v) { result = assoc_comm(op::AND, {from(*v->expr_1), from(*v->expr_2)}); },
+			[&] (unique_ptr<ast::or_op>& v) { result = assoc_comm(op::OR, {from(*v->expr_1), from(*v->expr_2)}); },
+			[&] (unique_ptr<ast::field>& v) { result = atom(field_text(*v) + ":Logical"); },
+			[&] (unique_ptr<ast::val_bool>& v) { result = atom(string(v->value ? "true" : "false") + ":Logical"); },
+			[&] (unique_ptr<ast::comparison>& v) { result = from(*v); },
+			[&] (unique_ptr<ast::negated>& v) { result = negation(from(*v->expr)); }
+		}, n.expr);
+		return result;
+	}
+
+	static auto print(term const& t) -> string {
+		auto print_infix = [&] (string const& op_text) {
+			auto output = string("(");
+			for (size_t i = 0; i < t.args.size(); i++) {
+				output += print(*t.args[i]);
+				if (i < t.args.size() - 1) {
+					output += " " + op_text + " ";
+				}
+			}
+			return output + ")";
+		};
+
+		switch (t.kind) {
+			case op::ATOM: return t.atom;
+			case op::ADD: return print_infix("+");
+			case op::MUL: return print_infix("*");
+			case op::NEG: return "-(" + print(*t.args[0]) + ")";
+			case op::INV: return "inv(" + print(*t.args[0]) + ")";
+			case op::MOD: return print_infix("%");
+			case op::EXP: return print_infix("^");
+			case op::EQS: return print_infix("eqs");
+			case op::LT: return print_infix("lt");
+			case op::NOT: return "not(" + print(*t.args[0]) + ")";
+			case op::AND: return print_infix("and");
+			case op::OR: return print_infix("or");
+			default: assert(false);
+		}
+	}
+};
+
+auto normal_form::of(ast::logical& n) -> normal_form {
+	return normal_form(normal_form_builder::from(n));
+}
+
+auto normal_form::of(ast::arithmetic& n) -> normal_form {
+	return normal_form(normal_form_builder::from(n));
+}
+
+auto normal_form::hash() const -> uint64_t {
+	return root->hash;
+}
+
+auto normal_form::operator==(normal_form const& other) const -> bool {
+	return normal_form_builder::compare(*root, *other.root) == 0;
+}
+
+auto normal_form::to_string() const -> string {
+	return normal_form_builder::print(*root);
+}
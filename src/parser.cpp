@@ -1,5 +1,8 @@
 #include "parser.h"
 #include "pegtl.hpp"
+#include "visitor.h"
+#include "thread_pool.h"
+#include "hash.h"
 
 #include <iostream>
 #include <cassert>
@@ -8,17 +11,24 @@
 #include <string>
 #include <functional>
 #include <type_traits>
-#include <fstream>
-#include <sstream>
-#include <map>
-#include <tuple>
+#include <string_view>
+#include <variant>
+#include <optional>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <filesystem>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace tao::pegtl;
 using std::unique_ptr;
 using std::make_unique;
 using std::vector;
-using std::map;
-using std::tuple;
 
 /*** Convenience types ***/
 template <typename... Ts>
@@ -53,6 +63,7 @@ namespace rules {
     struct kw_abs_assignment : TAO_PEGTL_STRING(":=") {};
     struct kw_rel_assignment : TAO_PEGTL_STRING("+=") {};
     struct kw_rate_field : TAO_PEGTL_STRING("->rate") {};
+    struct kw_import : TAO_PEGTL_STRING("import") {};
 
     /*** Types ***/
     struct ty_bool : TAO_PEGTL_STRING("bool") {};
@@ -68,7 +79,10 @@ namespace rules {
     // TODO: hacky addition to add on rate, will change if more subfields are added on
     struct field : sseq<unit_object, member_operator, identifier, opt<kw_rate_field>> {};
 
-    /*** Arithmetic ***/
+    /*** Expressions ***/
+    // Arithmetic and logical expressions share a single grammar, so that the contents of parentheses are parsed once
+    //  no matter which kind of expression they turn out to be. The actions check that each operand has the kind
+    //  required by its operator, and fail the match otherwise
     struct add_op : one<'+'> {};
     struct sub_op : one<'-'> {};
     struct mul_op : one<'*'> {};
@@ -76,16 +90,6 @@ namespace rules {
     struct mod_op : one<'%'> {};
     struct exp_op : one<'^'> {};
 
-    struct arithmetic; struct add; struct mul_factor; struct mul; struct exp_factor; struct exp;
-    struct arithmetic_value : sor<field, val_float, val_int, sseq<one<'('>, arithmetic, one<')'>>> {};
-    struct arithmetic : sseq<mul_factor, star<add>> {};
-    struct add : sseq<sor<add_op, sub_op>, mul_factor> {};
-    struct mul_factor : sseq<exp_factor, star<mul>> {};
-    struct mul : sseq<sor<mul_op, div_op, mod_op>, exp_factor> {};
-    struct exp_factor : sseq<arithmetic_value, opt<exp>> {};
-    struct exp : sseq<exp_op, arithmetic_value> {};
-
-    /*** Logical ***/
     struct and_op : TAO_PEGTL_STRING("and") {};
     struct or_op : TAO_PEGTL_STRING("or") {};
     struct not_op : TAO_PEGTL_STRING("not") {};
@@ -96,21 +100,35 @@ namespace rules {
     struct gte_op : seq<one<'>'>, one<'='>> {};
     struct lte_op : seq<one<'<'>, one<'='>> {};
 
-    struct comparison : sseq<arithmetic, sor<eq_op, neq_op, gte_op, lte_op, gt_op, lt_op>, arithmetic> {};
+    struct expression;
+    struct primary : sor<field, val_float, val_int, val_bool, sseq<one<'('>, expression, one<')'>>> {};
+
+    /*** Arithmetic ***/
+    struct add; struct mul_factor; struct mul; struct exp_factor; struct exp;
+    struct arithmetic : sseq<mul_factor, star<add>> {};
+    struct add : sseq<sor<add_op, sub_op>, mul_factor> {};
+    struct mul_factor : sseq<exp_factor, star<mul>> {};
+    struct mul : sseq<sor<mul_op, div_op, mod_op>, exp_factor> {};
+    struct exp_factor : sseq<primary, opt<exp>> {};
+    struct exp : sseq<exp_op, primary> {};
+
+    /*** Logical ***/
+    // A comparison without an operator is just the arithmetic expression (or primary) on its left
+    struct comparison : sseq<arithmetic, sopt<sor<eq_op, neq_op, gte_op, lte_op, gt_op, lt_op>, arithmetic>> {};
 
-    struct logical; struct negated; struct or_expr; struct and_factor; struct and_expr;
-    struct logical_value : sor<comparison, val_bool, negated, sseq<one<'('>, logical, one<')'>>, field> {};
+    struct negated; struct or_expr; struct and_factor; struct and_expr;
+    struct logical_value : sor<comparison, negated> {};
     struct negated : sseq<not_op, logical_value> {};
-    struct logical : sseq<and_factor, star<or_expr>> {};
+    struct expression : sseq<and_factor, star<or_expr>> {};
     struct or_expr : sseq<or_op, and_factor> {};
     struct and_factor : sseq<logical_value, star<and_expr>> {};
     struct and_expr : sseq<and_op, logical_value> {};
 
     /*** Always body and expressions ***/
     struct always_body;
-    struct assignment : sseq<field, sor<kw_abs_assignment, kw_rel_assignment>, sor<arithmetic, logical>, one<';'>> {};
-    struct continuous_if : sseq<kw_if, logical, one<'{'>, always_body, one<'}'>> {};
-    struct transition_if : sseq<kw_if, kw_becomes, logical, one<'{'>, always_body, one<'}'>> {};
+    struct assignment : sseq<field, sor<kw_abs_assignment, kw_rel_assignment>, expression, one<';'>> {};
+    struct continuous_if : sseq<kw_if, expression, one<'{'>, always_body, one<'}'>> {};
+    struct transition_if : sseq<kw_if, kw_becomes, expression, one<'{'>, always_body, one<'}'>> {};
     struct for_in : sseq<kw_for, identifier, kw_in_range, sor<val_float, val_int>, kw_of, unit_object,
         opt<kw_with_trait, cslist<identifier>>, one<'{'>, always_body, one<'}'>> {};
 
@@ -126,110 +144,235 @@ namespace rules {
     struct trait_initializer : sseq<identifier, opt<one<'('>, cslist<trait_property_init>, one<')'>>> {};
     struct unit_traits : sseq<kw_unit, identifier, one<':'>, cslist<trait_initializer>, one<';'>> {};
 
+    /*** Imports ***/
+    struct import_path : plus<not_one<'"', '\n'>> {};
+    struct import_decl : sseq<kw_import, seq<one<'"'>, import_path, one<'"'>>> {};
+
     /*** Root node ***/
-    struct program : sseq<sstar<sor<trait, unit_traits>>, eof> {};
+    struct program : sseq<sstar<sor<import_decl, trait, unit_traits>>, eof> {};
 };
 
-/*** Custom node type for parse tree ***/
-struct ast_node : parse_tree::node {
-    template <typename... States>
-    void emplace_back(std::unique_ptr<ast_node>&& child, States&&... st) {
-        children.emplace_back(std::move(child));
+// Read-only mapping of an input file, which is parsed in place without being copied, or the contents given by the
+//  caller for the file, which are shared with the caller as they are
+// A file that parses successfully keeps its mapping for as long as it is cached, so that positions in it can be
+//  resolved without a copy of the file. Files are expected to be replaced rather than truncated in place while glc
+//  runs, as editors and build tools do when saving
+struct mapped_file {
+    char const* data = nullptr;
+    size_t size = 0;
+    bool valid = false;
+    bool mapped = false;
+    std::shared_ptr<std::string const> given;
+
+    mapped_file(std::shared_ptr<std::string const> contents)
+        : data(contents->data()), size(contents->size()), valid(true), given(std::move(contents)) {}
+
+    mapped_file(std::string const& filename) {
+        auto fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) == 0) {
+            size = static_cast<size_t>(file_stat.st_size);
+            if (size == 0) {
+                // Empty files cannot be mapped, but are still valid input
+                data = "";
+                valid = true;
+            } else {
+                auto mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapping != MAP_FAILED) {
+                    data = static_cast<char const*>(mapping);
+                    valid = true;
+                    mapped = true;
+                }
+            }
+        }
+        close(fd);
+    }
+
+    ~mapped_file() {
+        if (mapped) {
+            munmap(const_cast<char*>(data), size);
+        }
     }
 
-    unique_ptr<ast::node> data;
-    vector<unique_ptr<ast_node>> children;
+    mapped_file(mapped_file const&) = delete;
+    auto operator=(mapped_file const&) -> mapped_file& = delete;
 };
 
-// Pointer to pass manager to report errors
-pass_manager* pm;
+// An entry of the construction stack: either a finished AST node, or the text of a token that points into the input
+using stack_item = std::variant<unique_ptr<ast::node>, std::string_view>;
+
+// The items pushed onto the construction stack while matching the current rule
+class arguments {
+public:
+    arguments(stack_item* first, size_t count) : first(first), count(count) {}
 
-// The latest position reached by the parser in case of parsing error
-size_t latest_line, latest_col;
+    auto size() const -> size_t {
+        return count;
+    }
+
+    auto kind(size_t i) const -> ast::node_kind {
+        return std::get<unique_ptr<ast::node>>(first[i])->get_id();
+    }
+
+    auto is_token(size_t i) const -> bool {
+        return std::holds_alternative<std::string_view>(first[i]);
+    }
+
+    auto token(size_t i) const -> std::string_view {
+        return std::get<std::string_view>(first[i]);
+    }
+
+    auto node(size_t i) -> unique_ptr<ast::node>& {
+        return std::get<unique_ptr<ast::node>>(first[i]);
+    }
+
+    template <typename Target>
+    auto take(size_t i) -> unique_ptr<Target> {
+        return unique_ptr<Target>(static_cast<Target*>(node(i).release()));
+    }
+
+private:
+    stack_item* first;
+    size_t count;
+};
+
+// A file imported by the file being parsed, with the offset of the import for error messages
+struct import_ref {
+    std::string path;
+    uint32_t offset;
+};
+
+// All state used while parsing a single input
+struct parse_state {
+    parse_state(pass_manager& pm, ast::file_table::file_id file, char const* begin)
+        : pm(pm), file(file), begin(begin) {}
+
+    // Used to report errors
+    pass_manager& pm;
+
+    // The file being parsed, and the start of its contents, which node spans are relative to
+    ast::file_table::file_id file;
+    char const* begin;
+
+    // The latest offset reached by the parser in case of parsing error
+    size_t latest_offset = 0;
+
+    // Finished AST nodes and tokens that have not yet been consumed by the rule containing them
+    vector<stack_item> stack;
+
+    // The height of the stack when each rule currently being matched was started
+    vector<size_t> marks;
+
+    // The files imported by the input, in the order they appear
+    vector<import_ref> imports;
+
+    // Returns the items pushed by the rule that just matched
+    auto args() -> arguments {
+        auto base = marks.back();
+        return arguments(stack.data() + base, stack.size() - base);
+    }
+
+    // Replaces the items pushed by the rule that just matched with the given result
+    void reduce(stack_item result) {
+        discard();
+        stack.push_back(std::move(result));
+    }
 
-// Stores input to parser that will be used to track line / col numbers
-// Input is created by concatenating all input files together
-unique_ptr<string_input<>> input;
+    // Removes the items pushed by the rule that just matched
+    void discard() {
+        stack.erase(stack.begin() + marks.back(), stack.end());
+    }
+};
 
-// Map from starting line number in input to corresponding input file
-map<size_t, std::string> line_to_file;
+// Control class that undoes the pushes of rules that fail, so that backtracking leaves the stack consistent
+template <typename Rule>
+struct build_control : normal<Rule> {
+    template <typename Input>
+    static void start(Input const&, parse_state& st) {
+        st.marks.push_back(st.stack.size());
+    }
 
-// Stores resulting program AST
-unique_ptr<ast::program> program_ast;
+    template <typename Input>
+    static void success(Input const&, parse_state& st) {
+        st.marks.pop_back();
+    }
 
-/*** Selectors for AST nodes ***/
-namespace selectors {
-    template <typename Target, typename Source>
-    auto own_as(unique_ptr<Source>& src) -> unique_ptr<Target> {
-        return unique_ptr<Target>(static_cast<Target*>(src.release()));
+    template <typename Input>
+    static void failure(Input const& in, parse_state& st) {
+        st.stack.erase(st.stack.begin() + st.marks.back(), st.stack.end());
+        st.marks.pop_back();
+        normal<Rule>::failure(in, st);
     }
+};
+
+/*** Actions that construct AST nodes ***/
+namespace actions {
+    template <typename Rule>
+    struct build : nothing<Rule> {};
 
     namespace utility {
-        static auto get_pos_in_file(size_t line_number) -> tuple<std::string, size_t> {
-            auto result_file = std::string();
-            auto result_line = 0UL;
-            for (auto& [line, filename] : line_to_file) {
-                if (line_number >= line) {
-                    result_file = filename;
-                    result_line = line_number - line;
-                }
-            }
-            return {result_file, result_line};
+        // Add tracking info of the file and the span of source text that produced the given AST node
+        template <typename ActionInput>
+        static void add_tracking(ActionInput const& in, parse_state& st, ast::node& n) {
+            n.file() = st.file;
+            n.span() = {static_cast<uint32_t>(in.begin() - st.begin), static_cast<uint32_t>(in.size())};
         }
 
-        // Add tracking info of filename, line number, and column to the given AST node
-        template <typename AstNode>
-        static void add_tracking(AstNode& n) {
-            // Find the filename and its start line
-            auto const& [filename, line] = get_pos_in_file(input->line());
-            n.filename() = filename;
-            n.line() = line;
-            n.col() = input->byte_in_line() + 1;
+        // Records the position reached by the parser, which is the end of the rule that just matched
+        template <typename ActionInput>
+        static void track_position(ActionInput const& in, parse_state& st) {
+            st.latest_offset = static_cast<size_t>(in.end() - st.begin);
         }
 
-        // Base selector class used by all others that sets line and col number
-        // Expects that n->data is set by Impl
-        template <typename Impl>
-        struct generic_selector : parse_tree::apply<generic_selector<Impl>> {
-            template <typename Node, typename... States>
-            static void transform(unique_ptr<Node>& n, States&&... st) {
-                latest_line = input->line();
-                latest_col = input->byte_in_line() + 1;
+        // Action used when producing only one type of AST node from the items pushed by the rule
+        // If Impl::apply returns a bool, returning false rejects the items and fails the match
+        template <typename Impl, typename ASTNodeType>
+        struct node_action {
+            template <typename ActionInput>
+            static auto apply(ActionInput const& in, parse_state& st) -> bool {
+                track_position(in, st);
 
-                Impl::transform(n);
+                auto data = make_unique<ASTNodeType>();
+                add_tracking(in, st, *data);
 
-                if (n->data->get_id() == ast::program::id()) {
-                    program_ast = own_as<ast::program>(n->data);
+                auto args = st.args();
+                if constexpr (std::is_same_v<decltype(Impl::apply(in.string_view(), args, st, data.get())), bool>) {
+                    if (!Impl::apply(in.string_view(), args, st, data.get())) {
+                        return false;
+                    }
+                } else {
+                    Impl::apply(in.string_view(), args, st, data.get());
                 }
-            }
-        };
-
-        // Selector class used when producing only one type of AST node
-        template <typename Impl, typename ASTNodeType>
-        struct selector : generic_selector<selector<Impl, ASTNodeType>> {
-            template <typename Node>
-            static void transform(unique_ptr<Node>& n) {
-                auto data = make_unique<ASTNodeType>();
-                add_tracking(*data);
 
-                Impl::apply(*n.get(), data.get());
-                n->data = std::move(data);
+                st.reduce(std::move(data));
+                return true;
             }
         };
 
         template <typename ASTNodeType>
         struct empty {
-            static void apply(ast_node& n, ASTNodeType *data) {}
+            static void apply(std::string_view, arguments&, parse_state&, ASTNodeType *data) {}
         };
         template <typename ASTNodeType>
-        using empty_sel = selector<empty<ASTNodeType>, ASTNodeType>;
+        using empty_action = node_action<empty<ASTNodeType>, ASTNodeType>;
+
+        // Action for rules whose items are consumed by the enclosing rule, which only records the position
+        struct position_action {
+            template <typename ActionInput>
+            static void apply(ActionInput const& in, parse_state& st) {
+                track_position(in, st);
+            }
+        };
 
-        // This selector simply takes that data from the Ith child and sets it as its own
-        template <unsigned I>
-        struct preserve_sel : generic_selector<preserve_sel<I>> {
-            template <typename Node>
-            static void transform(unique_ptr<Node>& n) {
-                n->data = std::move(n->children[I]->data);
+        // Action for tokens that the enclosing rule needs to inspect, which pushes the matched text
+        struct token_action {
+            template <typename ActionInput>
+            static void apply(ActionInput const& in, parse_state& st) {
+                st.stack.emplace_back(in.string_view());
             }
         };
     };
@@ -237,45 +380,50 @@ namespace selectors {
     using namespace utility;
 
     struct val_bool {
-        static void apply(ast_node& n, ast::val_bool *data) {
-            data->value = n.string() == "true" ? true : false;
+        static void apply(std::string_view text, arguments&, parse_state&, ast::val_bool *data) {
+            data->value = text == "true";
         }
     };
-    using val_bool_sel = typename selector<val_bool, ast::val_bool>::on<rules::val_bool>;
+    template <> struct build<rules::val_bool> : node_action<val_bool, ast::val_bool> {};
 
     struct val_float {
-        static void apply(ast_node& n, ast::val_float *data) {
+        static void apply(std::string_view text, arguments&, parse_state& st, ast::val_float *data) {
+            auto value = std::string(text);
             try {
-                data->value = std::stod(n.string());
+                data->value = std::stod(value);
             } catch (...) {
-                pm->error<parser>(*data, "Float value " + n.string() + " is out of bounds");
+                st.pm.error<parser>(*data, "Float value " + value + " is out of bounds");
             }
         }
     };
-    using val_float_sel = typename selector<val_float, ast::val_float>::on<rules::val_float>;
+    template <> struct build<rules::val_float> : node_action<val_float, ast::val_float> {};
 
     struct val_int {
-        static void apply(ast_node& n, ast::val_int *data) {
+        static void apply(std::string_view text, arguments&, parse_state& st, ast::val_int *data) {
+            auto value = std::string(text);
             try {
-                data->value = std::stol(n.string());
+                data->value = std::stol(value);
             } catch (...) {
-                pm->error<parser>(*data, "Integer value " + n.string() + " is out of bounds");
+                st.pm.error<parser>(*data, "Integer value " + value + " is out of bounds");
             }
         }
     };
-    using val_int_sel = typename selector<val_int, ast::val_int>::on<rules::val_int>;
+    template <> struct build<rules::val_int> : node_action<val_int, ast::val_int> {};
+
+    template <> struct build<rules::ty_bool> : empty_action<ast::ty_bool> {};
+    template <> struct build<rules::ty_float> : empty_action<ast::ty_float> {};
 
     struct ty_int {
-        static void apply(ast_node& n, ast::ty_int *data) {
-            data->min = own_as<ast::val_int>(n.children[0]->data)->value;
-            data->max = own_as<ast::val_int>(n.children[1]->data)->value;
+        static void apply(std::string_view, arguments& args, parse_state&, ast::ty_int *data) {
+            data->min = args.take<ast::val_int>(0)->value;
+            data->max = args.take<ast::val_int>(1)->value;
         }
     };
-    using ty_int_sel = typename selector<ty_int, ast::ty_int>::on<rules::ty_int>;
+    template <> struct build<rules::ty_int> : node_action<ty_int, ast::ty_int> {};
 
     struct variable_type {
-        static void apply(ast_node& n, ast::variable_type *data) {
-            auto type_id = n.children[0]->data->get_id();
+        static void apply(std::string_view, arguments& args, parse_state&, ast::variable_type *data) {
+            auto type_id = args.kind(0);
 
             if (type_id == ast::ty_bool::id()) {
                 data->type = ast::type_enum::BOOL;
@@ -285,7 +433,7 @@ namespace selectors {
             }
             else if (type_id == ast::ty_int::id()) {
                 data->type = ast::type_enum::INT;
-                auto int_child = own_as<ast::ty_int>(n.children[0]->data);
+                auto int_child = args.take<ast::ty_int>(0);
                 data->min = int_child->min;
                 data->max = int_child->max;
             }
@@ -294,126 +442,207 @@ namespace selectors {
             }
         }
     };
-    using variable_type_sel = typename selector<variable_type, ast::variable_type>::on<rules::variable_type>;
+    template <> struct build<rules::variable_type> : node_action<variable_type, ast::variable_type> {};
 
     struct variable_decl {
-        static void apply(ast_node& n, ast::variable_decl *data) {
-            data->name = n.children[0]->string();
-            data->type = own_as<ast::variable_type>(n.children[1]->data);
+        static void apply(std::string_view, arguments& args, parse_state&, ast::variable_decl *data) {
+            data->name = args.token(0);
+            data->type = args.take<ast::variable_type>(1);
             ast::set_parent(data, data->type);
         };
     };
-    using variable_decl_sel = typename selector<variable_decl, ast::variable_decl>::on<rules::variable_decl>;
+    template <> struct build<rules::variable_decl> : node_action<variable_decl, ast::variable_decl> {};
 
     struct properties {
-        static void apply(ast_node& n, ast::properties *data) {
-            for (auto& child : n.children) {
-                ast::set_parent(data, child->data);
-                data->variable_declarations.push_back(own_as<ast::variable_decl>(child->data));
+        static void apply(std::string_view, arguments& args, parse_state&, ast::properties *data) {
+            for (size_t i = 0; i < args.size(); i++) {
+                ast::set_parent(data, args.node(i));
+                data->variable_declarations.push_back(args.take<ast::variable_decl>(i));
             }
         }
     };
-    using properties_sel = typename selector<properties, ast::properties>::on<rules::properties>;
+    template <> struct build<rules::properties> : node_action<properties, ast::properties> {};
 
     struct trait {
-        static void apply(ast_node& n, ast::trait *data) {
-            data->name = n.children[0]->string();
-            data->props = own_as<ast::properties>(n.children[1]->data);
-            data->body = own_as<ast::always_body>(n.children[2]->data);
+        static void apply(std::string_view, arguments& args, parse_state&, ast::trait *data) {
+            data->name = args.token(0);
+            data->props = args.take<ast::properties>(1);
+            data->body = args.take<ast::always_body>(2);
             ast::set_parent(data, data->props, data->body);
         }
     };
-    using trait_sel = typename selector<trait, ast::trait>::on<rules::trait>;
-
-    auto parse_unit_object(ast_node& n) -> ast::unit_object {
-        auto unit = ast::unit_object();
+    template <> struct build<rules::trait> : node_action<trait, ast::trait> {};
 
-        if (n.is_type<rules::kw_this>()) {
-            unit = ast::this_unit();
-        }
-        else if (n.is_type<rules::kw_type>()) {
-            unit = ast::type_unit();
+    // Converts the token pushed by rules::unit_object into a unit object
+    auto parse_unit_object(std::string_view token) -> ast::unit_object {
+        // Keywords are matched before identifiers, so an identifier can never have the text of a keyword
+        if (token == "this") {
+            return ast::this_unit();
         }
-        else if (n.is_type<identifier>()) {
-            unit = ast::identifier_unit(n.string());
+        else if (token == "type") {
+            return ast::type_unit();
         }
         else {
-            assert(false && "Provided parse tree node does not contain a unit object");
+            return ast::identifier_unit(std::string(token));
         }
-
-        return unit;
     }
 
     struct field {
-        static void apply(ast_node& n, ast::field *data) {
-            data->unit = parse_unit_object(*n.children[0]);
+        static void apply(std::string_view, arguments& args, parse_state&, ast::field *data) {
+            data->unit = parse_unit_object(args.token(0));
 
-            auto& member_op = n.children[1];
+            auto member_op = args.token(1);
 
-            if (member_op->string() == "::")
+            if (member_op == "::")
                 data->member_op = ast::member_op_enum::BUILTIN;
-            else if (member_op->string() == ".")
+            else if (member_op == ".")
                 data->member_op = ast::member_op_enum::CUSTOM;
-            else if (member_op->string() == "->")
+            else if (member_op == "->")
                 data->member_op = ast::member_op_enum::LANGUAGE;
 
-            data->field_name = n.children[2]->string();
-            data->is_rate = n.children.size() > 3;
+            data->field_name = args.token(2);
+            data->is_rate = args.size() > 3;
         }
     };
-    using field_sel = typename selector<field, ast::field>::on<rules::field>;
+    template <> struct build<rules::field> : node_action<field, ast::field> {};
+
+    // Operands are left on the stack as they were parsed, and only converted into the kind of expression required
+    //  once an operator or statement consumes them, which fails the match if the operand has the wrong kind
+    // The wrappers created by the conversion take the position of the node that they wrap
+    namespace operands {
+        auto is_arithmetic(ast::node_kind kind) -> bool {
+            return kind == ast::arithmetic::id() || kind == ast::val_int::id() || kind == ast::val_float::id() ||
+                kind == ast::field::id();
+        }
 
-    // For nodes of the form                        o
-    //                        |            |                |              |
-    //                        T           Op T             Op T           Op T
+        auto is_logical(ast::node_kind kind) -> bool {
+            return kind == ast::logical::id() || kind == ast::val_bool::id() || kind == ast::comparison::id() ||
+                kind == ast::negated::id() || kind == ast::field::id();
+        }
+
+        template <typename ASTNodeType>
+        auto make_at(ast::node& n) -> unique_ptr<ASTNodeType> {
+            auto result = make_unique<ASTNodeType>();
+            result->file() = n.file();
+            result->span() = n.span();
+            return result;
+        }
+
+        // Takes the operand at index i, which must satisfy is_arithmetic, as an arithmetic expression
+        auto take_arithmetic(arguments& args, size_t i) -> unique_ptr<ast::arithmetic> {
+            auto kind = args.kind(i);
+            if (kind == ast::arithmetic::id()) {
+                return args.take<ast::arithmetic>(i);
+            }
+
+            auto arithmetic_val = make_at<ast::arithmetic_value>(*args.node(i));
+            ast::set_parent(arithmetic_val, args.node(i));
+            if (kind == ast::val_int::id())        arithmetic_val->value = args.take<ast::val_int>(i)->value;
+            else if (kind == ast::val_float::id()) arithmetic_val->value = args.take<ast::val_float>(i)->value;
+            else if (kind == ast::field::id())     arithmetic_val->value = args.take<ast::field>(i);
+
+            auto data = make_at<ast::arithmetic>(*arithmetic_val);
+            ast::set_parent(data, arithmetic_val);
+            data->expr = std::move(arithmetic_val);
+            return data;
+        }
+
+        // Takes the operand at index i, which must satisfy is_logical, as a logical expression
+        auto take_logical(arguments& args, size_t i) -> unique_ptr<ast::logical> {
+            auto kind = args.kind(i);
+            if (kind == ast::logical::id()) {
+                return args.take<ast::logical>(i);
+            }
+
+            auto data = make_at<ast::logical>(*args.node(i));
+            ast::set_parent(data, args.node(i));
+            if (kind == ast::field::id())
+                data->expr = args.take<ast::field>(i);
+            else if (kind == ast::val_bool::id())
+                data->expr = args.take<ast::val_bool>(i);
+            else if (kind == ast::comparison::id())
+                data->expr = args.take<ast::comparison>(i);
+            else if (kind == ast::negated::id())
+                data->expr = args.take<ast::negated>(i);
+            return data;
+        }
+
+        template <typename T>
+        auto is_operand(ast::node_kind kind) -> bool {
+            if constexpr (std::is_same_v<T, ast::arithmetic>) {
+                return is_arithmetic(kind);
+            } else {
+                return is_logical(kind);
+            }
+        }
+
+        template <typename T>
+        auto take_operand(arguments& args, size_t i) -> unique_ptr<T> {
+            if constexpr (std::is_same_v<T, ast::arithmetic>) {
+                return take_arithmetic(args, i);
+            } else {
+                return take_logical(args, i);
+            }
+        }
+    }
+
+    using namespace operands;
+
+    // For rules whose items are of the form      T Op T Op T ... Op T
     //
     // where op represents a binary operation, and T represents a term in the algebra,
-    // constructs a left-associative expression tree from the parse tree
+    // constructs a left-associative expression tree from the items
     //
-    // The rules that this applies to are arithmetic, mul_factor, exp_factor, logical, and and_factor. Their selectors
-    //  must CRTP this class and implement a function create_op: this function takes the rule corresponding to the
-    //  operation, and the LHS and RHS expressions, and returns a unique_ptr<T> representing the binary operation,
+    // The rules that this applies to are arithmetic, mul_factor, exp_factor, expression, and and_factor. Their actions
+    //  must CRTP this class and implement a function create_op: this function takes the token of the operation,
+    //  and the LHS and RHS expressions, and returns a unique_ptr<T> representing the binary operation,
     //  setting all parent-child relationships correctly. It can do this by using the construct_op function in this struct
     template <typename Impl, typename T>
-    struct expression_tree_builder : generic_selector<expression_tree_builder<Impl, T>> {
-        template <typename Node>
-        static void transform(unique_ptr<Node>& n) {
-            if (n->children.size() == 1) {
-                n->data = std::move(n->children[0]->data);
-                return;
+    struct expression_tree_builder {
+        template <typename ActionInput>
+        static auto apply(ActionInput const& in, parse_state& st) -> bool {
+            track_position(in, st);
+
+            // A single term is left on the stack as it is, whatever its kind
+            auto args = st.args();
+            if (args.size() == 1) {
+                return true;
+            }
+
+            for (size_t i = 0; i < args.size(); i += 2) {
+                if (!is_operand<T>(args.kind(i))) {
+                    return false;
+                }
             }
 
             // Construct a left associative tree of operations
-            auto cur_root = own_as<T>(n->children[0]->data);
-            for (unsigned i = 1; i < n->children.size(); i++) {
+            auto cur_root = take_operand<T>(args, 0);
+            for (size_t i = 1; i + 1 < args.size(); i += 2) {
                 auto expr_1 = std::move(cur_root);
-                auto expr_2 = own_as<T>(n->children[i]->data);
+                auto expr_2 = take_operand<T>(args, i + 1);
 
-                // Extract the operator from the current child and provide it to the Impl
-                //  so that the Impl creates the correct node type
-                auto& op = n->children[i]->children[0];
-                cur_root = Impl::create_op(*op, std::move(expr_1), std::move(expr_2));
+                // Provide the operator token to the Impl so that the Impl creates the correct node type
+                cur_root = Impl::create_op(args.token(i), std::move(expr_1), std::move(expr_2));
             }
 
-            // Set the final node containing the total "product" as the data for this node in the parse tree
-            n->data = std::move(cur_root);
+            // The final node containing the total "product" replaces the items of this rule
+            st.reduce(unique_ptr<ast::node>(std::move(cur_root)));
+            return true;
         }
 
         template <typename Op>
         static auto construct_op(unique_ptr<T>&& expr_1, unique_ptr<T>&& expr_2) -> unique_ptr<T> {
             auto op = make_unique<Op>();
-            op->col() = expr_2->col();
-            op->line() = expr_2->line();
-            op->filename() = expr_2->filename();
+            op->file() = expr_2->file();
+            op->span() = expr_2->span();
 
             op->expr_1 = std::move(expr_1);
             op->expr_2 = std::move(expr_2);
             ast::set_parent(op, op->expr_1, op->expr_2);
 
             auto wrapper = make_unique<T>();
-            wrapper->col() = op->col();
-            wrapper->line() = op->line();
-            wrapper->filename() = op->filename();
+            wrapper->file() = op->file();
+            wrapper->span() = op->span();
 
             ast::set_parent(wrapper, op);
             wrapper->expr = std::move(op);
@@ -422,327 +651,582 @@ namespace selectors {
     };
 
     namespace arithmetic {
-        // The following selectors generate a tree of nodes of type ast::arithmetic
-
-        struct arithmetic_value : generic_selector<arithmetic_value> {
-            template <typename Node>
-            static void transform(unique_ptr<Node>& n) {
-                auto& child = n->children[0];
-                auto& child_data = n->children[0]->data;
-
-                if (child->template is_type<rules::arithmetic>()) {
-                    n->data = own_as<ast::arithmetic>(child_data);
-                    return;
-                }
-
-                // If the child is not an arithmetic expression already, we must wrap it in an arithmetic_value object
-                auto arithmetic_val = make_unique<ast::arithmetic_value>();
-                ast::set_parent(arithmetic_val, child_data);
-                if (child->template is_type<rules::val_int>())        arithmetic_val->value = own_as<ast::val_int>(child_data)->value;
-                else if (child->template is_type<rules::val_float>()) arithmetic_val->value = own_as<ast::val_float>(child_data)->value;
-                else if (child->template is_type<rules::field>())     arithmetic_val->value = own_as<ast::field>(child_data);
-                add_tracking(*arithmetic_val);
-
-                auto data = make_unique<ast::arithmetic>();
-                ast::set_parent(data, arithmetic_val);
-                data->expr = std::move(arithmetic_val);
-                n->data = std::move(data);
-                add_tracking(*n->data);
-            }
-        };
-        using arithmetic_value_sel = typename arithmetic_value::on<rules::arithmetic_value>;
+        // The following actions generate a tree of nodes of type ast::arithmetic
 
         struct arithmetic : expression_tree_builder<arithmetic, ast::arithmetic> {
-            static auto create_op(ast_node& op, unique_ptr<ast::arithmetic>&& expr_1, unique_ptr<ast::arithmetic>&& expr_2) -> unique_ptr<ast::arithmetic> {
-                if (op.is_type<rules::add_op>())
+            static auto create_op(std::string_view op, unique_ptr<ast::arithmetic>&& expr_1, unique_ptr<ast::arithmetic>&& expr_2) -> unique_ptr<ast::arithmetic> {
+                if (op == "+")
                     return construct_op<ast::add>(std::move(expr_1), std::move(expr_2));
-                else if (op.is_type<rules::sub_op>())
+                else if (op == "-")
                     return construct_op<ast::sub>(std::move(expr_1), std::move(expr_2));
                 else
                     assert(false && "Unexpected operation");
             }
         };
-        using arithmetic_sel = typename arithmetic::on<rules::arithmetic>;
 
         struct mul_factor : expression_tree_builder<mul_factor, ast::arithmetic> {
-            static auto create_op(ast_node& op, unique_ptr<ast::arithmetic>&& expr_1, unique_ptr<ast::arithmetic>&& expr_2) -> unique_ptr<ast::arithmetic> {
-                if (op.is_type<rules::mul_op>())
+            static auto create_op(std::string_view op, unique_ptr<ast::arithmetic>&& expr_1, unique_ptr<ast::arithmetic>&& expr_2) -> unique_ptr<ast::arithmetic> {
+                if (op == "*")
                     return construct_op<ast::mul>(std::move(expr_1), std::move(expr_2));
-                else if (op.is_type<rules::div_op>())
+                else if (op == "/")
                     return construct_op<ast::div>(std::move(expr_1), std::move(expr_2));
-                else if (op.is_type<rules::mod_op>())
+                else if (op == "%")
                     return construct_op<ast::mod>(std::move(expr_1), std::move(expr_2));
                 else
                     assert(false && "Unexpected operation");
             }
         };
-        using mul_factor_sel = typename mul_factor::on<rules::mul_factor>;
 
         struct exp_factor : expression_tree_builder<exp_factor, ast::arithmetic> {
-            static auto create_op(ast_node& op, unique_ptr<ast::arithmetic>&& expr_1, unique_ptr<ast::arithmetic>&& expr_2) -> unique_ptr<ast::arithmetic> {
+            static auto create_op(std::string_view op, unique_ptr<ast::arithmetic>&& expr_1, unique_ptr<ast::arithmetic>&& expr_2) -> unique_ptr<ast::arithmetic> {
                 return construct_op<ast::exp>(std::move(expr_1), std::move(expr_2));
             }
         };
-        using exp_factor_sel = typename exp_factor::on<rules::exp_factor>;
-
-        using add_sel = typename preserve_sel<1>::on<rules::add>;
-        using mul_sel = typename preserve_sel<1>::on<rules::mul>;
-        using exp_sel = typename preserve_sel<1>::on<rules::exp>;
     }
+    template <> struct build<rules::arithmetic> : arithmetic::arithmetic {};
+    template <> struct build<rules::mul_factor> : arithmetic::mul_factor {};
+    template <> struct build<rules::exp_factor> : arithmetic::exp_factor {};
+    template <> struct build<rules::add> : position_action {};
+    template <> struct build<rules::mul> : position_action {};
+    template <> struct build<rules::exp> : position_action {};
 
     namespace logical {
-        // The following selectors generate a tree of nodes of type ast::logical
+        // The following actions generate a tree of nodes of type ast::logical
 
         struct comparison {
-            static void apply(ast_node& n, ast::comparison *data) {
-                data->lhs = own_as<ast::arithmetic>(n.children[0]->data);
-                data->rhs = own_as<ast::arithmetic>(n.children[2]->data);
+            template <typename ActionInput>
+            static auto apply(ActionInput const& in, parse_state& st) -> bool {
+                track_position(in, st);
+
+                // Without a comparison operator, the arithmetic expression is left on the stack as it is
+                auto args = st.args();
+                if (args.size() == 1) {
+                    return true;
+                }
+
+                if (!is_arithmetic(args.kind(0)) || !is_arithmetic(args.kind(2))) {
+                    return false;
+                }
+
+                auto data = make_unique<ast::comparison>();
+                add_tracking(in, st, *data);
+
+                data->lhs = take_arithmetic(args, 0);
+                data->rhs = take_arithmetic(args, 2);
                 ast::set_parent(data, data->lhs, data->rhs);
 
-                auto& op = n.children[1];
-                if (op->template is_type<rules::eq_op>()) data->comparison_type = ast::comparison_enum::EQ;
-                if (op->template is_type<rules::neq_op>()) data->comparison_type = ast::comparison_enum::NEQ;
-                if (op->template is_type<rules::gt_op>()) data->comparison_type = ast::comparison_enum::GT;
-                if (op->template is_type<rules::lt_op>()) data->comparison_type = ast::comparison_enum::LT;
-                if (op->template is_type<rules::gte_op>()) data->comparison_type = ast::comparison_enum::GTE;
-                if (op->template is_type<rules::lte_op>()) data->comparison_type = ast::comparison_enum::LTE;
-            };
+                auto op = args.token(1);
+                if (op == "==") data->comparison_type = ast::comparison_enum::EQ;
+                if (op == "!=") data->comparison_type = ast::comparison_enum::NEQ;
+                if (op == ">") data->comparison_type = ast::comparison_enum::GT;
+                if (op == "<") data->comparison_type = ast::comparison_enum::LT;
+                if (op == ">=") data->comparison_type = ast::comparison_enum::GTE;
+                if (op == "<=") data->comparison_type = ast::comparison_enum::LTE;
+
+                st.reduce(unique_ptr<ast::node>(std::move(data)));
+                return true;
+            }
         };
-        using comparison_sel = typename selector<comparison, ast::comparison>::on<rules::comparison>;
 
         struct negated {
-            static void apply(ast_node& n, ast::negated *data) {
-                data->expr = own_as<ast::logical>(n.children[0]->data);
-                ast::set_parent(data, data->expr);
-            };
-        };
-        using negated_sel = typename selector<negated, ast::negated>::on<rules::negated>;
-
-        struct logical_value : generic_selector<logical_value> {
-            template <typename Node>
-            static void transform(unique_ptr<Node>& n) {
-                auto& child = n->children[0];
-                auto& child_data = n->children[0]->data;
-
-                if (child->template is_type<rules::logical>()) {
-                    auto temp = own_as<ast::logical>(child_data);
-                    n->data = own_as<ast::logical>(temp);
-                    return;
+            static auto apply(std::string_view, arguments& args, parse_state&, ast::negated *data) -> bool {
+                if (!is_logical(args.kind(0))) {
+                    return false;
                 }
 
-                // If the child is not a logical expression already, we must wrap it in one
-                // comparison, val_bool, negated, sseq<one<'('>, logical, one<')'>>, field
-                auto data = make_unique<ast::logical>();
-                ast::set_parent(data, child_data);
-                if (child->template is_type<rules::field>())
-                    data->expr = own_as<ast::field>(child_data);
-                else if (child->template is_type<rules::val_bool>())
-                    data->expr = own_as<ast::val_bool>(child_data);
-                else if (child->template is_type<rules::comparison>())
-                    data->expr = own_as<ast::comparison>(child_data);
-                else if (child->template is_type<rules::negated>())
-                    data->expr = own_as<ast::negated>(child_data);
-
-                n->data = std::move(data);
-                add_tracking(*n->data);
-            }
+                data->expr = take_logical(args, 0);
+                ast::set_parent(data, data->expr);
+                return true;
+            };
         };
-        using logical_value_sel = typename logical_value::on<rules::logical_value>;
 
-        struct logical : expression_tree_builder<logical, ast::logical> {
-            static auto create_op(ast_node& op, unique_ptr<ast::logical>&& expr_1, unique_ptr<ast::logical>&& expr_2) -> unique_ptr<ast::logical> {
+        struct expression : expression_tree_builder<expression, ast::logical> {
+            static auto create_op(std::string_view, unique_ptr<ast::logical>&& expr_1, unique_ptr<ast::logical>&& expr_2) -> unique_ptr<ast::logical> {
                 return construct_op<ast::or_op>(std::move(expr_1), std::move(expr_2));
             }
         };
-        using logical_sel = typename logical::on<rules::logical>;
 
         struct and_factor : expression_tree_builder<and_factor, ast::logical> {
-            static auto create_op(ast_node& op, unique_ptr<ast::logical>&& expr_1, unique_ptr<ast::logical>&& expr_2) -> unique_ptr<ast::logical> {
+            static auto create_op(std::string_view, unique_ptr<ast::logical>&& expr_1, unique_ptr<ast::logical>&& expr_2) -> unique_ptr<ast::logical> {
                 return construct_op<ast::and_op>(std::move(expr_1), std::move(expr_2));
             }
         };
-        using and_factor_sel = typename and_factor::on<rules::and_factor>;
-
-        using or_expr_sel = preserve_sel<1>::on<rules::or_expr>;
-        using and_expr_sel = preserve_sel<1>::on<rules::and_expr>;
     }
+    template <> struct build<rules::comparison> : logical::comparison {};
+    template <> struct build<rules::negated> : node_action<logical::negated, ast::negated> {};
+    template <> struct build<rules::expression> : logical::expression {};
+    template <> struct build<rules::and_factor> : logical::and_factor {};
+    template <> struct build<rules::or_expr> : position_action {};
+    template <> struct build<rules::and_expr> : position_action {};
 
     struct assignment {
-        static void apply(ast_node& n, ast::assignment *data) {
-            ast::set_parent(data, n.children[0]->data, n.children[2]->data);
+        static auto apply(std::string_view, arguments& args, parse_state&, ast::assignment *data) -> bool {
+            // A right hand side that could be either kind of expression (a field) is an arithmetic expression
+            auto rhs_kind = args.kind(2);
+            if (is_arithmetic(rhs_kind)) {
+                auto rhs = take_arithmetic(args, 2);
+                ast::set_parent(data, rhs);
+                data->rhs = std::move(rhs);
+            } else if (is_logical(rhs_kind)) {
+                auto rhs = take_logical(args, 2);
+                ast::set_parent(data, rhs);
+                data->rhs = std::move(rhs);
+            } else {
+                return false;
+            }
 
-            data->lhs = own_as<ast::field>(n.children[0]->data);
+            data->lhs = args.take<ast::field>(0);
+            ast::set_parent(data, data->lhs);
 
-            auto& assignment_type = n.children[1];
-            if (assignment_type->template is_type<rules::kw_abs_assignment>()) {
+            auto assignment_type = args.token(1);
+            if (assignment_type == ":=") {
                 data->assignment_type = ast::assignment_enum::ABSOLUTE;
-            } else if (assignment_type->template is_type<rules::kw_rel_assignment>()) {
+            } else if (assignment_type == "+=") {
                 data->assignment_type = ast::assignment_enum::RELATIVE;
             }
-
-            auto& rhs = n.children[2];
-            if (rhs->template is_type<rules::arithmetic>()) {
-                data->rhs = own_as<ast::arithmetic>(rhs->data);
-            } else if (rhs->template is_type<rules::logical>()) {
-                data->rhs = own_as<ast::logical>(rhs->data);
-            }
+            return true;
         }
     };
-    using assignment_sel = typename selector<assignment, ast::assignment>::on<rules::assignment>;
+    template <> struct build<rules::assignment> : node_action<assignment, ast::assignment> {};
 
     template <typename IfAstType>
     struct if_expr {
-        static void apply(ast_node& n, IfAstType *data) {
-            data->condition = own_as<ast::logical>(n.children[0]->data);
-            data->body = own_as<ast::always_body>(n.children[1]->data);
+        static auto apply(std::string_view, arguments& args, parse_state&, IfAstType *data) -> bool {
+            if (!is_logical(args.kind(0))) {
+                return false;
+            }
+
+            data->condition = take_logical(args, 0);
+            data->body = args.take<ast::always_body>(1);
             ast::set_parent(data, data->condition, data->body);
+            return true;
         }
     };
-    using continuous_if_sel = typename selector<if_expr<ast::continuous_if>, ast::continuous_if>::on<rules::continuous_if>;
-    using transition_if_sel = typename selector<if_expr<ast::transition_if>, ast::transition_if>::on<rules::transition_if>;
+    template <> struct build<rules::continuous_if> : node_action<if_expr<ast::continuous_if>, ast::continuous_if> {};
+    template <> struct build<rules::transition_if> : node_action<if_expr<ast::transition_if>, ast::transition_if> {};
 
     struct for_in {
-        static void apply(ast_node& n, ast::for_in *data) {
-            data->variable = n.children[0]->string();
+        static void apply(std::string_view, arguments& args, parse_state&, ast::for_in *data) {
+            data->variable = args.token(0);
 
-            if (n.children[1]->template is_type<rules::val_int>())
-                data->range = own_as<ast::val_int>(n.children[1]->data)->value;
-            else if (n.children[1]->template is_type<rules::val_float>())
-                data->range = own_as<ast::val_float>(n.children[1]->data)->value;
+            if (args.kind(1) == ast::val_int::id())
+                data->range = args.take<ast::val_int>(1)->value;
+            else if (args.kind(1) == ast::val_float::id())
+                data->range = args.take<ast::val_float>(1)->value;
 
-            data->range_unit = parse_unit_object(*n.children[2]);
+            data->range_unit = parse_unit_object(args.token(2));
 
-            // Parse the next set of children as required traits as long as they are identifiers
-            for (unsigned i = 3; n.children[i]->template is_type<identifier>(); i++) {
-                data->traits.push_back(n.children[i]->string());
+            // The items between the unit and the body are the required traits
+            for (size_t i = 3; args.is_token(i); i++) {
+                data->traits.push_back(ast::symbol(args.token(i)));
             }
 
-            data->body = own_as<ast::always_body>(n.children.back()->data);
+            data->body = args.take<ast::always_body>(args.size() - 1);
             ast::set_parent(data, data->body);
         }
     };
-    using for_in_sel = typename selector<for_in, ast::for_in>::on<rules::for_in>;
+    template <> struct build<rules::for_in> : node_action<for_in, ast::for_in> {};
 
     struct always_body {
-        static void apply(ast_node& n, ast::always_body *data) {
-            for (auto& child : n.children) {
-                ast::set_parent(data, child->data);
-
-                if (child->template is_type<rules::assignment>()) {
-                    data->exprs.push_back(own_as<ast::assignment>(child->data));
-                } else if (child->template is_type<rules::continuous_if>()) {
-                    data->exprs.push_back(own_as<ast::continuous_if>(child->data));
-                } else if (child->template is_type<rules::transition_if>()) {
-                    data->exprs.push_back(own_as<ast::transition_if>(child->data));
-                } else if (child->template is_type<rules::for_in>()) {
-                    data->exprs.push_back(own_as<ast::for_in>(child->data));
+        static void apply(std::string_view, arguments& args, parse_state&, ast::always_body *data) {
+            for (size_t i = 0; i < args.size(); i++) {
+                ast::set_parent(data, args.node(i));
+
+                auto kind = args.kind(i);
+                if (kind == ast::assignment::id()) {
+                    data->exprs.push_back(args.take<ast::assignment>(i));
+                } else if (kind == ast::continuous_if::id()) {
+                    data->exprs.push_back(args.take<ast::continuous_if>(i));
+                } else if (kind == ast::transition_if::id()) {
+                    data->exprs.push_back(args.take<ast::transition_if>(i));
+                } else if (kind == ast::for_in::id()) {
+                    data->exprs.push_back(args.take<ast::for_in>(i));
                 } else {
                     assert("Unhandled child in rule always_body");
                 }
             }
         }
     };
-    using always_body_sel = typename selector<always_body, ast::always_body>::on<rules::always_body>;
+    template <> struct build<rules::always_body> : node_action<always_body, ast::always_body> {};
 
     struct trait_initializer {
-        static void apply(ast_node& n, ast::trait_initializer *data) {
-            data->name = n.children[0]->string();
-            for (unsigned i = 1; i < n.children.size(); i += 2) {
-                auto property = n.children[i]->string();
-                auto& value_node = n.children[i + 1];
+        static void apply(std::string_view, arguments& args, parse_state&, ast::trait_initializer *data) {
+            data->name = args.token(0);
+            for (size_t i = 1; i + 1 < args.size(); i += 2) {
+                auto property = std::string(args.token(i));
+                auto value_kind = args.kind(i + 1);
 
                 auto value = ast::literal_value();
-                if (value_node->template is_type<rules::val_bool>())
-                    value = own_as<ast::val_bool>(value_node->data)->value;
-                else if (value_node->template is_type<rules::val_int>())
-                    value = own_as<ast::val_int>(value_node->data)->value;
-                else if (value_node->template is_type<rules::val_float>())
-                    value = own_as<ast::val_float>(value_node->data)->value;
+                if (value_kind == ast::val_bool::id())
+                    value = args.take<ast::val_bool>(i + 1)->value;
+                else if (value_kind == ast::val_int::id())
+                    value = args.take<ast::val_int>(i + 1)->value;
+                else if (value_kind == ast::val_float::id())
+                    value = args.take<ast::val_float>(i + 1)->value;
 
                 data->initial_values[property] = value;
             }
         }
     };
-    using trait_initializer_sel = typename selector<trait_initializer, ast::trait_initializer>::on<rules::trait_initializer>;
+    template <> struct build<rules::trait_initializer> : node_action<trait_initializer, ast::trait_initializer> {};
 
     struct unit_traits {
-        static void apply(ast_node& n, ast::unit_traits *data) {
-            data->name = n.children[0]->string();
-            for (unsigned i = 1; i < n.children.size(); i++) {
-                ast::set_parent(data, n.children[i]->data);
-                data->traits.push_back(own_as<ast::trait_initializer>(n.children[i]->data));
+        static void apply(std::string_view, arguments& args, parse_state&, ast::unit_traits *data) {
+            data->name = args.token(0);
+            for (size_t i = 1; i < args.size(); i++) {
+                ast::set_parent(data, args.node(i));
+                data->traits.push_back(args.take<ast::trait_initializer>(i));
             }
         }
     };
-    using unit_traits_sel = typename selector<unit_traits, ast::unit_traits>::on<rules::unit_traits>;
-
-    struct program : generic_selector<program> {
-        template <typename Node>
-        static void transform(unique_ptr<Node>& n) {
-            auto data = make_unique<ast::program>();
-            for (auto& child : n->children) {
-                ast::set_parent(data, child->data);
-
-                if (child->template is_type<rules::trait>()) {
-                    data->traits.push_back(own_as<ast::trait>(child->data));
-                } else if (child->template is_type<rules::unit_traits>()) {
-                    data->all_unit_traits.push_back(own_as<ast::unit_traits>(child->data));
+    template <> struct build<rules::unit_traits> : node_action<unit_traits, ast::unit_traits> {};
+
+    struct program {
+        static void apply(std::string_view, arguments& args, parse_state&, ast::program *data) {
+            for (size_t i = 0; i < args.size(); i++) {
+                ast::set_parent(data, args.node(i));
+
+                auto kind = args.kind(i);
+                if (kind == ast::trait::id()) {
+                    data->traits.push_back(args.take<ast::trait>(i));
+                } else if (kind == ast::unit_traits::id()) {
+                    data->all_unit_traits.push_back(args.take<ast::unit_traits>(i));
                 } else {
                     assert("Unhandled child in rule program");
                 }
             }
+        }
+    };
+    template <> struct build<rules::program> : node_action<program, ast::program> {};
+
+    // Imports are recorded separately rather than added to the AST, since the files are parsed on their own
+    // Unlike AST nodes, an import is located at its start, so that errors point at the import itself
+    struct import_decl {
+        template <typename ActionInput>
+        static void apply(ActionInput const& in, parse_state& st) {
+            track_position(in, st);
+
+            auto args = st.args();
+            st.imports.push_back({std::string(args.token(0)), static_cast<uint32_t>(in.begin() - st.begin)});
+            st.discard();
+        }
+    };
+    template <> struct build<rules::import_decl> : import_decl {};
+    template <> struct build<rules::import_path> : token_action {};
+
+    // Tokens that are inspected by the rules containing them
+    template <> struct build<identifier> : token_action {};
+    template <> struct build<rules::member_operator> : token_action {};
+    template <> struct build<rules::kw_this> : token_action {};
+    template <> struct build<rules::kw_type> : token_action {};
+    template <> struct build<rules::kw_abs_assignment> : token_action {};
+    template <> struct build<rules::kw_rel_assignment> : token_action {};
+    template <> struct build<rules::kw_rate_field> : token_action {};
+    template <> struct build<rules::add_op> : token_action {};
+    template <> struct build<rules::sub_op> : token_action {};
+    template <> struct build<rules::mul_op> : token_action {};
+    template <> struct build<rules::div_op> : token_action {};
+    template <> struct build<rules::mod_op> : token_action {};
+    template <> struct build<rules::exp_op> : token_action {};
+    template <> struct build<rules::and_op> : token_action {};
+    template <> struct build<rules::or_op> : token_action {};
+    template <> struct build<rules::eq_op> : token_action {};
+    template <> struct build<rules::neq_op> : token_action {};
+    template <> struct build<rules::gt_op> : token_action {};
+    template <> struct build<rules::lt_op> : token_action {};
+    template <> struct build<rules::gte_op> : token_action {};
+    template <> struct build<rules::lte_op> : token_action {};
+};
+
+// Collects the nodes of a tree in the order that they are visited
+struct collect_nodes_visitor {
+    vector<ast::node*> nodes;
+
+    template <typename AstNode>
+    void operator()(AstNode& n) {
+        nodes.push_back(&n);
+    }
+};
+
+// clone() only copies the structure of a tree, so the positions of the copy are taken from the original node by node
+static auto clone_with_positions(ast::program& original) -> unique_ptr<ast::program> {
+    auto copy = original.clone();
+
+    auto original_nodes = collect_nodes_visitor();
+    ::visit<ast::program, collect_nodes_visitor>()(original, original_nodes);
+    auto copy_nodes = collect_nodes_visitor();
+    ::visit<ast::program, collect_nodes_visitor>()(*copy, copy_nodes);
+
+    assert(original_nodes.nodes.size() == copy_nodes.nodes.size());
+    for (size_t i = 0; i < copy_nodes.nodes.size(); i++) {
+        copy_nodes.nodes[i]->file() = original_nodes.nodes[i]->file();
+        copy_nodes.nodes[i]->span() = original_nodes.nodes[i]->span();
+    }
+    return copy;
+}
+
+// The result of parsing one file, which is shared by every compilation that reads the same contents from it
+// The AST is never modified, and compilations work on copies of it
+struct parsed_file {
+    uint64_t hash;
+    std::shared_ptr<std::string_view const> contents;
+    unique_ptr<ast::program> program;
+    vector<import_ref> imports;
+};
+
+// Files that have been parsed successfully by this process, keyed by their canonical path
+// Long-running processes parse files at paths chosen by their clients, so only the most recently used files are
+//  kept, up to a total of max_bytes of contents. Their ASTs are not measured, but grow with the contents
+class parse_cache {
+public:
+    static constexpr size_t max_bytes = 256 * 1024 * 1024;
+
+    static auto get() -> parse_cache& {
+        static auto instance = parse_cache();
+        return instance;
+    }
+
+    // Returns the parsed file if it was last parsed with the same contents, and nullptr otherwise
+    auto lookup(std::string const& key, std::string_view contents) -> std::shared_ptr<parsed_file const> {
+        auto contents_hash = hash::fnv1a(contents);
+
+        auto guard = std::lock_guard(lock);
+        auto it = files.find(key);
+        if (it == files.end() || it->second.file->hash != contents_hash || *it->second.file->contents != contents) {
+            return nullptr;
+        }
+        recent.splice(recent.begin(), recent, it->second.position);
+        return it->second.file;
+    }
 
-            n->data = std::move(data);
-            add_tracking(*n->data);
+    void store(std::string const& key, std::shared_ptr<parsed_file const> file) {
+        auto guard = std::lock_guard(lock);
+        auto it = files.find(key);
+        if (it != files.end()) {
+            bytes -= it->second.file->contents->size();
+            recent.erase(it->second.position);
+            files.erase(it);
         }
+
+        auto size = file->contents->size();
+        while (!recent.empty() && bytes + size > max_bytes) {
+            auto oldest = files.find(recent.back());
+            bytes -= oldest->second.file->contents->size();
+            files.erase(oldest);
+            recent.pop_back();
+        }
+
+        recent.push_front(key);
+        files.emplace(key, entry{std::move(file), recent.begin()});
+        bytes += size;
+    }
+
+private:
+    struct entry {
+        std::shared_ptr<parsed_file const> file;
+        std::list<std::string>::iterator position;
     };
-    using program_sel = typename program::on<rules::program>;
 
-    using namespace arithmetic;
-    using namespace logical;
+    std::mutex lock;
+    std::unordered_map<std::string, entry> files;
+    // Keys of the cached files, from the most to the least recently used
+    std::list<std::string> recent;
+    // Total size of the contents of the cached files
+    size_t bytes = 0;
+};
 
-    template <typename Rule>
-    using ast_selector = parse_tree::selector<Rule,
-        val_bool_sel, val_float_sel, val_int_sel,
-        empty_sel<ast::ty_bool>::on<rules::ty_bool>, empty_sel<ast::ty_float>::on<rules::ty_float>, ty_int_sel,
-        variable_type_sel, variable_decl_sel, properties_sel,
-        field_sel,
-        arithmetic_value_sel, arithmetic_sel, mul_factor_sel, exp_factor_sel, add_sel, mul_sel, exp_sel,
-        comparison_sel, negated_sel, logical_value_sel, logical_sel, and_factor_sel, or_expr_sel, and_expr_sel,
-        assignment_sel, continuous_if_sel, transition_if_sel, for_in_sel,
-        always_body_sel,
-        trait_sel, unit_traits_sel, trait_initializer_sel, program_sel,
-
-        parse_tree::store_content::on<
-            identifier,
-            rules::member_operator, rules::kw_this, rules::kw_type,
-            rules::kw_abs_assignment, rules::kw_rel_assignment, rules::kw_rate_field,
-            rules::add_op, rules::sub_op, rules::mul_op, rules::div_op, rules::mod_op, rules::exp_op,
-            rules::and_op, rules::or_op,
-            rules::eq_op, rules::neq_op, rules::gt_op, rules::lt_op, rules::gte_op, rules::lte_op
-        >
-    >;
+// A file that is part of the program being compiled
+struct source_file {
+    // The path as it is shown in error messages
+    std::string path;
+    // Contents given by the caller instead of being read from the path
+    std::shared_ptr<std::string const> contents;
+    // The file and offset of the import that added this file, which are only resolved to a position on error
+    bool imported = false;
+    ast::file_table::file_id importer = 0;
+    uint32_t import_offset = 0;
+
+    std::shared_ptr<parsed_file const> parsed;
+    bool reused = false;
+    vector<std::string> errors;
+    // Indices of the files imported by this file, in the order they are imported
+    vector<size_t> imports;
 };
 
-parser::parser(pass_manager& pm, std::string input_file) {
-    ::pm = &pm;
-    latest_line = 1;
-    latest_col = 1;
+// Parses the file, or takes it from the cache if its contents have not changed, recording any errors in the file
+static void parse_file(source_file& file, std::string const& key) {
+    auto file_input = file.contents ? std::make_shared<mapped_file const>(file.contents) :
+        std::make_shared<mapped_file const>(file.path);
+    if (!file_input->valid) {
+        if (!file.imported) {
+            file.errors.push_back(file.path + ": Could not read input file");
+        } else {
+            auto [line, col] = ast::file_table::resolve(file.importer, file.import_offset);
+            file.errors.push_back(ast::file_table::name(file.importer) + ":" + std::to_string(line) + ":" +
+                std::to_string(col) + ": Could not read imported file " + file.path);
+        }
+        return;
+    }
+
+    auto contents = std::string_view(file_input->data, file_input->size);
+    if (auto cached = parse_cache::get().lookup(key, contents)) {
+        file.parsed = std::move(cached);
+        file.reused = true;
+        return;
+    }
+
+    // Errors are collected by a pass manager of this file, since files are parsed concurrently
+    auto file_pm = pass_manager();
+    // The mapping is kept so that node spans can be resolved to lines and columns when a diagnostic is reported
+    auto result = std::make_shared<parsed_file>();
+    auto [id, file_contents] = ast::file_table::add(file.path, contents, std::move(file_input));
+    result->contents = std::move(file_contents);
+    auto st = parse_state(file_pm, id, contents.data());
+
+    // Tokens on the stack point into the input, and the AST copies everything it needs out of them
+    // Spans are computed from pointers into the input, so PEGTL does not need to count lines while parsing
+    auto input = memory_input<tracking_mode::lazy>(contents.data(), contents.data() + contents.size(), "");
+    if (parse<rules::program, actions::build, build_control>(input, st)) {
+        result->program = unique_ptr<ast::program>(static_cast<ast::program*>(std::get<unique_ptr<ast::node>>(st.stack.back()).release()));
+    }
+
+    if (!result->program) {
+        auto [line, col] = ast::file_table::resolve(id, static_cast<uint32_t>(st.latest_offset));
+        file_pm.error<parser>(file.path + ":" + std::to_string(line) + ":" + std::to_string(col) + ": Syntax error: parsing failed");
+    }
+
+    file.errors = std::move(file_pm.get_errors<parser>());
+    if (!file.errors.empty()) {
+        return;
+    }
+
+    result->hash = hash::fnv1a(contents);
+    result->imports = std::move(st.imports);
+    parse_cache::get().store(key, result);
+    file.parsed = std::move(result);
+}
+
+parser::parser(pass_manager& pm, std::string input_file) : parser(pm, vector<std::string>{input_file}, options()) {}
+
+parser::parser(pass_manager& pm, vector<std::string> input_files, options opts) {
+    // The grammar is only analyzed by the first parser of the process
+    static auto const grammar_issues = analyze<rules::program>();
+    assert(grammar_issues == 0);
+
+    // Files are identified by their canonical path, so that a file that is imported several times is only parsed once
+    // Elements of a deque are never moved, so tasks can keep pointers to the file that they parse
+    auto sources = std::deque<source_file>();
+    auto index_of = std::unordered_map<std::string, size_t>();
+    auto files_lock = std::mutex();
+    auto pool = thread_pool(opts.jobs);
+
+    auto canonical = [](std::string const& path) {
+        auto error = std::error_code();
+        auto key = std::filesystem::weakly_canonical(path, error).string();
+        return error ? path : key;
+    };
+
+    auto given_contents = std::unordered_map<std::string, std::shared_ptr<std::string const>>();
+    for (auto& [path, contents] : opts.contents) {
+        given_contents[canonical(path)] = contents;
+    }
 
-    assert(analyze<rules::program>() == 0);
+    // Adds a file to the program if it is not already part of it, and returns its index
+    std::function<auto(std::string const&, source_file const*, uint32_t) -> size_t> add_file;
+    add_file = [&](std::string const& path, source_file const* importer, uint32_t import_offset) -> size_t {
+        auto key = canonical(path);
 
-    std::ifstream file(input_file);
-    std::stringstream buffer;
-    buffer << file.rdbuf();
+        auto guard = std::lock_guard(files_lock);
+        if (auto it = index_of.find(key); it != index_of.end()) {
+            return it->second;
+        }
 
-    input = make_unique<string_input<>>(buffer.str(), "");
-    line_to_file[0] = input_file;
+        auto index = sources.size();
+        index_of[key] = index;
+        auto& file = sources.emplace_back();
+        file.path = path;
+        if (auto it = given_contents.find(key); it != given_contents.end()) {
+            file.contents = it->second;
+        }
+        if (importer) {
+            file.imported = true;
+            file.importer = importer->parsed->program->file();
+            file.import_offset = import_offset;
+        }
 
-    parse_tree::parse<rules::program, ast_node, selectors::ast_selector>(*input);
+        pool.submit([&add_file, &file, key](unsigned) {
+            parse_file(file, key);
+            if (!file.parsed) {
+                return;
+            }
 
-    program = std::move(program_ast);
-    if (!program) {
-        auto const& [filename, line] = selectors::utility::get_pos_in_file(latest_line);
-        pm.error<parser>(filename + ":" + std::to_string(line) + ":" + std::to_string(latest_col) + ": Syntax error: parsing failed");
+            // Imported paths are relative to the directory of the file importing them
+            auto directory = std::filesystem::path(file.path).parent_path();
+            for (auto& import : file.parsed->imports) {
+                auto import_path = (directory / import.path).lexically_normal().string();
+                file.imports.push_back(add_file(import_path, &file, import.offset));
+            }
+        });
+        return index;
+    };
+
+    auto inputs = vector<size_t>();
+    for (auto& input_file : input_files) {
+        inputs.push_back(add_file(input_file, nullptr, 0));
+    }
+    pool.wait();
+
+    // Every file comes after the files it imports, and otherwise in the order the inputs were given
+    auto order = vector<size_t>();
+    auto visited = vector<bool>(sources.size(), false);
+    std::function<void(size_t)> add_in_order = [&](size_t index) {
+        if (visited[index]) {
+            return;
+        }
+        visited[index] = true;
+        for (auto imported : sources[index].imports) {
+            add_in_order(imported);
+        }
+        order.push_back(index);
+    };
+    for (auto input : inputs) {
+        add_in_order(input);
+    }
+
+    for (auto index : order) {
+        paths.push_back(sources[index].path);
+        for (auto& error : sources[index].errors) {
+            pm.error<parser>(error);
+        }
+    }
+    if (!pm.get_errors<parser>().empty()) {
+        return;
+    }
+
+    // Merge copies of the ASTs of all files, which are allocated by this thread unlike the cached ASTs
+    program = make_unique<ast::program>();
+    program_hash = hash::fnv_offset_basis;
+    for (auto index : order) {
+        auto file_program = clone_with_positions(*sources[index].parsed->program);
+        if (index == inputs.front()) {
+            program->file() = sources[index].parsed->program->file();
+            program->span() = sources[index].parsed->program->span();
+        }
+
+        for (auto& trait : file_program->traits) {
+            ast::set_parent(program, trait);
+            program->traits.push_back(std::move(trait));
+        }
+        for (auto& unit_traits : file_program->all_unit_traits) {
+            ast::set_parent(program, unit_traits);
+            program->all_unit_traits.push_back(std::move(unit_traits));
+        }
+
+        contents.push_back(sources[index].parsed->contents);
+        program_hash = hash::combine(program_hash, sources[index].parsed->hash);
+        files++;
+        if (sources[index].reused) {
+            reused++;
+        }
     }
 }
@@ -0,0 +1,158 @@
+#include "resolve_symbols.h"
+#include "parser.h"
+#include "visitor.h"
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
+
+using std::vector;
+using std::unordered_set;
+using std::unordered_map;
+
+struct resolve_symbols_visitor {
+	ast::program& program;
+	// Traits that changed since the program was last checked, whose users must be resolved again as well
+	unordered_set<ast::symbol> changed_traits;
+	// Properties of each trait by name, keeping the first declaration of names declared more than once
+	unordered_map<ast::trait*, unordered_map<ast::symbol, ast::variable_decl*>> properties;
+
+	// Scopes of the node being visited: its trait, and the loops it is in with the traits each loop is over,
+	//  in the order those traits appear in the program
+	ast::trait* cur_trait = nullptr;
+	struct loop_scope {
+		ast::for_in* loop;
+		vector<ast::trait*> traits;
+	};
+	vector<loop_scope> loops;
+
+	resolve_symbols_visitor(ast::program& program) : program(program) {
+		for (auto& trait : program.traits) {
+			auto& props = properties[trait.get()];
+			for (auto& decl : trait->props->variable_declarations) {
+				props.emplace(decl->name, decl.get());
+			}
+		}
+	}
+
+	auto find_loop(ast::symbol identifier) -> loop_scope* {
+		for (auto it = loops.rbegin(); it != loops.rend(); it++) {
+			if (it->loop->variable == identifier) {
+				return &*it;
+			}
+		}
+		return nullptr;
+	}
+
+	auto find_property(ast::trait* trait, ast::symbol name) -> ast::variable_decl* {
+		auto& props = properties[trait];
+		auto decl = props.find(name);
+		return decl == props.end() ? nullptr : decl->second;
+	}
+
+	auto refers_to_changed_trait(ast::node& n) -> bool {
+		if (ast::isa<ast::for_in>(n)) {
+			for (auto& trait : static_cast<ast::for_in&>(n).traits) {
+				if (changed_traits.find(trait) != changed_traits.end()) {
+					return true;
+				}
+			}
+		} else if (ast::isa<ast::trait_initializer>(n)) {
+			return changed_traits.find(static_cast<ast::trait_initializer&>(n).name) != changed_traits.end();
+		}
+		return false;
+	}
+
+	// Only enters nodes that changed, that are below a node that changed, or that refer to a trait that changed,
+	//  and nodes with such descendants. Nodes below a node that changed are marked as changed themselves, since
+	//  what they refer to may have changed along with it
+	auto enter(ast::node& n) -> bool {
+		if (!n.changed() && ((n.parent() && n.parent()->changed()) || refers_to_changed_trait(n))) {
+			ast::mark_changed(n);
+		}
+		if (!n.changed() && !n.changed_below()) {
+			return false;
+		}
+
+		if (ast::isa<ast::trait>(n)) {
+			cur_trait = static_cast<ast::trait*>(&n);
+		} else if (ast::isa<ast::for_in>(n)) {
+			enter_loop(static_cast<ast::for_in&>(n));
+		}
+		return true;
+	}
+
+	void enter_loop(ast::for_in& n) {
+		// The range is resolved before the loop is in scope, since it refers to an enclosing loop
+		if (n.changed()) {
+			auto range_loop = std::holds_alternative<ast::identifier_unit>(n.range_unit) ?
+				find_loop(std::get<ast::identifier_unit>(n.range_unit).identifier) : nullptr;
+			n.resolved_loop = range_loop ? range_loop->loop : nullptr;
+			n.resolved = true;
+		}
+
+		auto& scope = loops.emplace_back(loop_scope {&n, {}});
+		for (auto& trait : program.traits) {
+			if (std::find(n.traits.begin(), n.traits.end(), trait->name) != n.traits.end()) {
+				scope.traits.push_back(trait.get());
+			}
+		}
+	}
+
+	void operator()(ast::for_in& n) {
+		loops.pop_back();
+	}
+
+	void operator()(ast::field& n) {
+		if (!n.changed()) {
+			return;
+		}
+
+		n.resolved_loop = nullptr;
+		n.resolved_trait = nullptr;
+		n.resolved_decl = nullptr;
+		n.resolved = true;
+
+		std::visit(ast::overloaded {
+			[&] (ast::identifier_unit& u) {
+				auto scope = find_loop(u.identifier);
+				if (!scope) {
+					return;
+				}
+				n.resolved_loop = scope->loop;
+
+				// If several of the traits of the loop declare the property, the last one in the program is used
+				for (auto it = scope->traits.rbegin(); it != scope->traits.rend(); it++) {
+					if (auto decl = find_property(*it, n.field_name)) {
+						n.resolved_trait = *it;
+						n.resolved_decl = decl;
+						break;
+					}
+				}
+			},
+			[&] (auto& _) {
+				n.resolved_trait = cur_trait;
+				n.resolved_decl = cur_trait ? find_property(cur_trait, n.field_name) : nullptr;
+			}
+		}, n.unit);
+	}
+};
+
+resolve_symbols::resolve_symbols(pass_manager& pm)
+	: program(*pm.get_pass<parser>()->program)
+{
+	auto rsv = resolve_symbols_visitor(program);
+
+	// Changing the declarations of a trait can change what any use of its properties refers to, so the whole trait
+	//  is resolved again, along with loops over units with the trait and initializers of the trait
+	for (auto& trait : program.traits) {
+		if (trait->changed() || trait->props->changed() || trait->props->changed_below()) {
+			ast::mark_changed(*trait);
+			rsv.changed_traits.insert(trait->name);
+		}
+	}
+
+	visit<ast::program, decltype(rsv)>()(program, rsv);
+}
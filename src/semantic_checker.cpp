@@ -5,11 +5,13 @@
 
 #include <string>
 #include <set>
+#include <unordered_set>
 #include <memory>
 #include <type_traits>
 
 using std::string;
 using std::set;
+using std::unordered_set;
 using std::unique_ptr;
 
 auto quote(string const& input) -> string {
@@ -23,6 +25,15 @@ struct semantic_checker_visitor {
 
 	semantic_checker_visitor(pass_manager& pm, ast::program& program) : pm(pm), program(program) {}
 
+	// Only enters nodes that changed and nodes with descendants that changed, where resolve_symbols has already
+	//  marked everything that refers to a trait that changed
+	auto enter(ast::node& n) -> bool {
+		if (n.parent() && n.parent()->changed()) {
+			ast::mark_changed(n);
+		}
+		return n.changed() || n.changed_below();
+	}
+
 	template <typename AstNode>
 	void error(AstNode& n, string const& err) {
 		// Mark this node as well as all parent nodes as errored
@@ -50,7 +61,7 @@ struct semantic_checker_visitor {
 	}
 
 	void operator()(ast::properties& n) {
-		set<string> variable_names;
+		unordered_set<ast::symbol> variable_names;
 		for (auto& decl : n.variable_declarations) {
 			if (variable_names.find(decl->name) != variable_names.end()) {
 				auto& trait_name = ast::find_parent<ast::trait>(n)->name;
@@ -262,7 +273,7 @@ struct semantic_checker_visitor {
 
 	void operator()(ast::program& n) {
 		// Check for repeats in the list of traits
-		set<string> traits;
+		unordered_set<ast::symbol> traits;
 		for (auto& trait : n.traits) {
 			if (traits.find(trait->name) != traits.end()) {
 				error(n, "Trait " + quote(trait->name) + " declared more than once");
@@ -283,26 +294,38 @@ struct semantic_checker_visitor {
 
 // Wrapper struct that will skip semantic checks on nodes whose children have semantic errors
 //  on the conservative assumption that invalid children cause any analysis on parents to be meaningless
-// Additionally, checks that the AST is well formed and all parent pointers are correct
+// Additionally, checks that the AST is well formed and all parent pointers are correct, and clears the marks
+//  of every node visited, since it has now been checked
 template <typename Impl>
 struct optionally_skip_checks : Impl {
 	optionally_skip_checks(pass_manager& pm, ast::program& program) : Impl(pm, program) {}
 
-	template <typename AstNode, typename = typename std::enable_if<has_visitor<Impl, AstNode>::value>::type>
+	template <typename AstNode>
 	void operator()(AstNode& n) {
-		if (Impl::errored_nodes.find(static_cast<ast::node*>(&n)) == Impl::errored_nodes.end()) {
-			Impl::operator()(n);
+		if constexpr (has_visitor<Impl, AstNode>::value) {
+			if (Impl::errored_nodes.find(static_cast<ast::node*>(&n)) == Impl::errored_nodes.end()) {
+				Impl::operator()(n);
+			}
 		}
 
 		if constexpr (!std::is_same<AstNode, ast::program>::value) {
 			assert(ast::find_parent<ast::program>(n));
 		}
+		n.clear_changed();
 	}
 };
 
 semantic_checker::semantic_checker(pass_manager& pm)
+	: semantic_checker(pm, mode::full) {}
+
+semantic_checker::semantic_checker(pass_manager& pm, mode check_mode)
 	: pm(pm), program(*pm.get_pass<parser>()->program)
 {
 	auto scv = optionally_skip_checks<semantic_checker_visitor>(pm, program);
+
+	if (check_mode == mode::full) {
+		ast::mark_changed(program);
+	}
+
 	visit<ast::program, decltype(scv)>()(program, scv);
 }
@@ -0,0 +1,452 @@
+#include "serialize.h"
+
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <variant>
+
+namespace ast {
+	// Every value is followed by a space, strings are prefixed with their length, and every node starts
+	//  with its position followed by a tag if the node holds a variant
+	// Positions are stored as the offset of the span relative to the trait, or _ for nodes created by the
+	//  compiler rather than parsed, followed by the length of the span
+	struct writer {
+		string output;
+		uint32_t base_offset;
+
+		writer(uint32_t base_offset) : base_offset(base_offset) {}
+
+		void write(long value) {
+			output += std::to_string(value) + " ";
+		}
+
+		void write(double value) {
+			// Stored as bits so that the value is read back exactly
+			auto bits = uint64_t();
+			std::memcpy(&bits, &value, sizeof(bits));
+			output += std::to_string(bits) + " ";
+		}
+
+		void write(string const& value) {
+			output += std::to_string(value.length()) + ":" + value + " ";
+		}
+
+		void write_tag(char tag) {
+			output += tag;
+			output += ' ';
+		}
+
+		void write_position(node& n) {
+			if (n.file() == 0) {
+				write_tag('_');
+			} else {
+				write(static_cast<long>(n.span().offset) - static_cast<long>(base_offset));
+			}
+			write(static_cast<long>(n.span().length));
+		}
+
+		void write(field& n) {
+			write_position(n);
+			std::visit(overloaded {
+				[&] (this_unit _) { write_tag('t'); },
+				[&] (type_unit _) { write_tag('y'); },
+				[&] (identifier_unit u) { write_tag('i'); write(u.identifier); }
+			}, n.unit);
+			write(static_cast<long>(n.member_op));
+			write(n.field_name);
+			write(static_cast<long>(n.is_rate));
+		}
+
+		template <typename Op>
+		void write_binary(char tag, Op& op) {
+			write_tag(tag);
+			write_position(op);
+			write(*op.expr_1);
+			write(*op.expr_2);
+		}
+
+		void write(arithmetic& n) {
+			write_position(n);
+			std::visit(overloaded {
+				[&] (unique_ptr<add>& v) { write_binary('+', *v); },
+				[&] (unique_ptr<sub>& v) { write_binary('-', *v); },
+				[&] (unique_ptr<mul>& v) { write_binary('*', *v); },
+				[&] (unique_ptr<div>& v) { write_binary('/', *v); },
+				[&] (unique_ptr<mod>& v) { write_binary('%', *v); },
+				[&] (unique_ptr<exp>& v) { write_binary('^', *v); },
+				[&] (unique_ptr<arithmetic_value>& v) {
+					write_tag('v');
+					write_position(*v);
+					std::visit(overloaded {
+						[&] (unique_ptr<field>& val) { write_tag('f'); write(*val); },
+						[&] (long val) { write_tag('i'); write(val); },
+						[&] (double val) { write_tag('d'); write(val); }
+					}, v->value);
+				}
+			}, n.expr);
+		}
+
+		void write(logical& n) {
+			write_position(n);
+			std::visit(overloaded {
+				[&] (unique_ptr<and_op>& v) { write_binary('&', *v); },
+				[&] (unique_ptr<or_op>& v) { write_binary('|', *v); },
+				[&] (unique_ptr<field>& v) { write_tag('f'); write(*v); },
+				[&] (unique_ptr<val_bool>& v) { write_tag('b'); write_position(*v); write(static_cast<long>(v->value)); },
+				[&] (unique_ptr<comparison>& v) {
+					write_tag('c');
+					write_position(*v);
+					write(static_cast<long>(v->comparison_type));
+					write(*v->lhs);
+					write(*v->rhs);
+				},
+				[&] (unique_ptr<negated>& v) { write_tag('!'); write_position(*v); write(*v->expr); }
+			}, n.expr);
+		}
+
+		void write(always_body& n) {
+			write_position(n);
+			write(static_cast<long>(n.exprs.size()));
+			for (auto& expr : n.exprs) {
+				std::visit(overloaded {
+					[&] (unique_ptr<assignment>& v) {
+						write_tag('a');
+						write_position(*v);
+						write(*v->lhs);
+						write(static_cast<long>(v->assignment_type));
+						std::visit(overloaded {
+							[&] (unique_ptr<arithmetic>& rhs) { write_tag('A'); write(*rhs); },
+							[&] (unique_ptr<logical>& rhs) { write_tag('L'); write(*rhs); }
+						}, v->rhs);
+					},
+					[&] (unique_ptr<continuous_if>& v) { write_tag('c'); write_position(*v); write(*v->condition); write(*v->body); },
+					[&] (unique_ptr<transition_if>& v) { write_tag('t'); write_position(*v); write(*v->condition); write(*v->body); },
+					[&] (unique_ptr<for_in>& v) {
+						write_tag('l');
+						write_position(*v);
+						write(v->variable);
+						write(v->range);
+						std::visit(overloaded {
+							[&] (this_unit _) { write_tag('t'); },
+							[&] (type_unit _) { write_tag('y'); },
+							[&] (identifier_unit u) { write_tag('i'); write(u.identifier); }
+						}, v->range_unit);
+						write(static_cast<long>(v->traits.size()));
+						for (auto& trait_name : v->traits) {
+							write(trait_name);
+						}
+						write(*v->body);
+					}
+				}, expr);
+			}
+		}
+
+		void write(trait& n) {
+			write(n.name);
+			write_position(*n.props);
+			write(static_cast<long>(n.props->variable_declarations.size()));
+			for (auto& decl : n.props->variable_declarations) {
+				write_position(*decl);
+				write(decl->name);
+				write_position(*decl->type);
+				write(static_cast<long>(decl->type->type));
+				write(decl->type->min);
+				write(decl->type->max);
+			}
+			write(*n.body);
+		}
+	};
+
+	auto serialize(trait& t) -> string {
+		auto w = writer(t.span().offset);
+		w.write_position(t);
+		w.write(t);
+		return w.output;
+	}
+
+	struct reader {
+		std::string_view input;
+		size_t pos = 0;
+		uint32_t base_offset;
+		file_table::file_id file;
+
+		reader(std::string_view input, uint32_t base_offset, file_table::file_id file)
+			: input(input), base_offset(base_offset), file(file) {}
+
+		[[noreturn]] static void malformed() {
+			throw std::runtime_error("Malformed serialized trait");
+		}
+
+		// Returns the characters up to the next space, and consumes the space
+		auto read_token() -> std::string_view {
+			auto end = input.find(' ', pos);
+			if (end == std::string_view::npos) {
+				malformed();
+			}
+			auto token = input.substr(pos, end - pos);
+			pos = end + 1;
+			return token;
+		}
+
+		auto read_long() -> long {
+			return parse_long(read_token());
+		}
+
+		static auto parse_long(std::string_view token_view) -> long {
+			auto token = string(token_view);
+			try {
+				auto length = size_t();
+				auto value = std::stol(token, &length);
+				if (length != token.length()) {
+					malformed();
+				}
+				return value;
+			} catch (std::logic_error&) {
+				malformed();
+			}
+		}
+
+		auto read_double() -> double {
+			auto token = string(read_token());
+			try {
+				auto bits = static_cast<uint64_t>(std::stoull(token));
+				auto value = double();
+				std::memcpy(&value, &bits, sizeof(value));
+				return value;
+			} catch (std::logic_error&) {
+				malformed();
+			}
+		}
+
+		auto read_string() -> string {
+			auto colon = input.find(':', pos);
+			if (colon == std::string_view::npos) {
+				malformed();
+			}
+			auto length = size_t();
+			try {
+				length = std::stoul(string(input.substr(pos, colon - pos)));
+			} catch (std::logic_error&) {
+				malformed();
+			}
+			if (colon + 1 + length >= input.length() || input[colon + 1 + length] != ' ') {
+				malformed();
+			}
+			auto value = string(input.substr(colon + 1, length));
+			pos = colon + length + 2;
+			return value;
+		}
+
+		auto read_tag() -> char {
+			auto token = read_token();
+			if (token.length() != 1) {
+				malformed();
+			}
+			return token[0];
+		}
+
+		template <typename Enum>
+		auto read_enum(Enum last) -> Enum {
+			auto value = read_long();
+			if (value < 0 || value > static_cast<long>(last)) {
+				malformed();
+			}
+			return static_cast<Enum>(value);
+		}
+
+		struct position {
+			file_table::file_id file;
+			source_span span;
+		};
+
+		auto read_position() -> position {
+			auto offset_token = read_token();
+			auto length = static_cast<uint32_t>(read_long());
+			if (offset_token == "_") {
+				return {0, {0, length}};
+			}
+			return {file, {static_cast<uint32_t>(parse_long(offset_token) + static_cast<long>(base_offset)), length}};
+		}
+
+		template <typename Node>
+		auto placed(unique_ptr<Node>&& n, position p) -> unique_ptr<Node> {
+			n->file() = p.file;
+			n->span() = p.span;
+			return std::move(n);
+		}
+
+		auto read_unit() -> unit_object {
+			switch (read_tag()) {
+				case 't': return this_unit();
+				case 'y': return type_unit();
+				case 'i': return identifier_unit(read_string());
+				default: malformed();
+			}
+		}
+
+		auto read_field() -> unique_ptr<field> {
+			auto p = read_position();
+			auto unit = read_unit();
+			auto member_op = read_enum(member_op_enum::LANGUAGE);
+			auto field_name = read_string();
+			auto is_rate = read_long() != 0;
+			return placed(field::make(unit, member_op, field_name, is_rate), p);
+		}
+
+		template <typename Op>
+		auto read_arithmetic_op() -> unique_ptr<Op> {
+			auto p = read_position();
+			auto expr_1 = read_arithmetic();
+			auto expr_2 = read_arithmetic();
+			return placed(Op::make(std::move(expr_1), std::move(expr_2)), p);
+		}
+
+		template <typename Op>
+		auto read_logical_op() -> unique_ptr<Op> {
+			auto p = read_position();
+			auto expr_1 = read_logical();
+			auto expr_2 = read_logical();
+			return placed(Op::make(std::move(expr_1), std::move(expr_2)), p);
+		}
+
+		auto read_arithmetic() -> unique_ptr<arithmetic> {
+			auto p = read_position();
+			auto expr = arithmetic::arithmetic_expr();
+			switch (read_tag()) {
+				case '+': expr = read_arithmetic_op<add>(); break;
+				case '-': expr = read_arithmetic_op<sub>(); break;
+				case '*': expr = read_arithmetic_op<mul>(); break;
+				case '/': expr = read_arithmetic_op<div>(); break;
+				case '%': expr = read_arithmetic_op<mod>(); break;
+				case '^': expr = read_arithmetic_op<exp>(); break;
+				case 'v': {
+					auto value_p = read_position();
+					auto value = variant<unique_ptr<field>, long, double>();
+					switch (read_tag()) {
+						case 'f': value = read_field(); break;
+						case 'i': value = read_long(); break;
+						case 'd': value = read_double(); break;
+						default: malformed();
+					}
+					expr = placed(arithmetic_value::make(std::move(value)), value_p);
+					break;
+				}
+				default: malformed();
+			}
+			return placed(arithmetic::make(std::move(expr)), p);
+		}
+
+		auto read_logical() -> unique_ptr<logical> {
+			auto p = read_position();
+			auto expr = logical::logical_expr();
+			switch (read_tag()) {
+				case '&': expr = read_logical_op<and_op>(); break;
+				case '|': expr = read_logical_op<or_op>(); break;
+				case 'f': expr = read_field(); break;
+				case 'b': {
+					auto value_p = read_position();
+					expr = placed(val_bool::make(read_long() != 0), value_p);
+					break;
+				}
+				case 'c': {
+					auto comparison_p = read_position();
+					auto comparison_type = read_enum(comparison_enum::LTE);
+					auto lhs = read_arithmetic();
+					auto rhs = read_arithmetic();
+					expr = placed(comparison::make(std::move(lhs), std::move(rhs), comparison_type), comparison_p);
+					break;
+				}
+				case '!': {
+					auto negated_p = read_position();
+					expr = placed(negated::make(read_logical()), negated_p);
+					break;
+				}
+				default: malformed();
+			}
+			return placed(logical::make(std::move(expr)), p);
+		}
+
+		template <typename If>
+		auto read_if() -> unique_ptr<If> {
+			auto p = read_position();
+			auto condition = read_logical();
+			auto body = read_body();
+			return placed(If::make(std::move(condition), std::move(body)), p);
+		}
+
+		auto read_body() -> unique_ptr<always_body> {
+			auto p = read_position();
+			auto num_exprs = read_long();
+			auto exprs = vector<expression>();
+			for (long i = 0; i < num_exprs; i++) {
+				switch (read_tag()) {
+					case 'a': {
+						auto assignment_p = read_position();
+						auto lhs = read_field();
+						auto assignment_type = read_enum(assignment_enum::RELATIVE);
+						auto rhs = assignment::rhs_t();
+						switch (read_tag()) {
+							case 'A': rhs = read_arithmetic(); break;
+							case 'L': rhs = read_logical(); break;
+							default: malformed();
+						}
+						exprs.emplace_back(placed(assignment::make(std::move(lhs), assignment_type, std::move(rhs)), assignment_p));
+						break;
+					}
+					case 'c': exprs.emplace_back(read_if<continuous_if>()); break;
+					case 't': exprs.emplace_back(read_if<transition_if>()); break;
+					case 'l': {
+						auto loop_p = read_position();
+						auto variable = read_string();
+						auto range = read_double();
+						auto range_unit = read_unit();
+						auto num_traits = read_long();
+						auto traits = vector<symbol>();
+						for (long j = 0; j < num_traits; j++) {
+							traits.push_back(read_string());
+						}
+						auto body = read_body();
+						exprs.emplace_back(placed(for_in::make(variable, range, range_unit, traits, std::move(body)), loop_p));
+						break;
+					}
+					default: malformed();
+				}
+			}
+			return placed(always_body::make(std::move(exprs)), p);
+		}
+
+		auto read_trait() -> unique_ptr<trait> {
+			auto p = read_position();
+			auto name = read_string();
+
+			auto props_p = read_position();
+			auto num_decls = read_long();
+			auto decls = vector<unique_ptr<variable_decl>>();
+			for (long i = 0; i < num_decls; i++) {
+				auto decl_p = read_position();
+				auto decl_name = read_string();
+				auto type_p = read_position();
+				auto type = read_enum(type_enum::FLOAT);
+				auto min = read_long();
+				auto max = read_long();
+				auto decl_type = placed(variable_type::make(type, min, max), type_p);
+				decls.push_back(placed(variable_decl::make(std::move(decl_type), decl_name), decl_p));
+			}
+			auto props = placed(properties::make(std::move(decls)), props_p);
+
+			auto body = read_body();
+			if (pos != input.length()) {
+				malformed();
+			}
+			return placed(trait::make(name, std::move(props), std::move(body)), p);
+		}
+	};
+
+	auto deserialize_trait(std::string_view data, trait& location) -> unique_ptr<trait> {
+		try {
+			return reader(data, location.span().offset, location.file()).read_trait();
+		} catch (std::runtime_error&) {
+			return nullptr;
+		}
+	}
+};
@@ -0,0 +1,254 @@
+#include "server.h"
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <optional>
+#include <charconv>
+#include <cerrno>
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+using std::string;
+using std::vector;
+
+using steady_clock = std::chrono::steady_clock;
+
+// Reads lines and blocks of bytes from a file descriptor, keeping anything read past the current request
+class request_reader {
+public:
+	request_reader(int fd) : fd(fd) {}
+
+	// Reads the next line without its newline, returning false if the input ends first
+	auto read_line(string& line) -> bool {
+		auto newline_pos = string::npos;
+		while ((newline_pos = buffer.find('\n')) == string::npos) {
+			if (!fill()) {
+				return false;
+			}
+		}
+		line = buffer.substr(0, newline_pos);
+		buffer.erase(0, newline_pos + 1);
+		return true;
+	}
+
+	// Reads exactly count bytes, returning false if the input ends first
+	auto read_bytes(size_t count, string& bytes) -> bool {
+		while (buffer.length() < count) {
+			if (!fill()) {
+				return false;
+			}
+		}
+		bytes = buffer.substr(0, count);
+		buffer.erase(0, count);
+		return true;
+	}
+
+private:
+	auto fill() -> bool {
+		char chunk[64 * 1024];
+		while (true) {
+			auto bytes_read = read(fd, chunk, sizeof(chunk));
+			if (bytes_read < 0 && errno == EINTR) {
+				continue;
+			}
+			if (bytes_read <= 0) {
+				return false;
+			}
+			buffer.append(chunk, bytes_read);
+			return true;
+		}
+	}
+
+	int fd;
+	string buffer;
+};
+
+// Writes all of the text, returning false if the other side has gone away
+static auto write_all(int fd, string const& text) -> bool {
+	size_t written = 0;
+	while (written < text.length()) {
+		auto result = write(fd, text.data() + written, text.length() - written);
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result <= 0) {
+			return false;
+		}
+		written += result;
+	}
+	return true;
+}
+
+static auto split_words(string const& line) -> vector<string> {
+	auto words = vector<string>();
+	auto stream = std::istringstream(line);
+	for (auto word = string(); stream >> word;) {
+		words.push_back(word);
+	}
+	return words;
+}
+
+// Sources are refused instead of being buffered once those given for the next compilation would be longer than this
+//  in total, so that a client cannot make the server hold an unbounded amount of input
+static constexpr size_t max_source_length = 256 * 1024 * 1024;
+
+// Parses the length of a source request, which must consist only of decimal digits
+static auto parse_length(string const& word) -> std::optional<size_t> {
+	auto length = size_t(0);
+	auto end = word.data() + word.length();
+	auto [parsed_end, error] = std::from_chars(word.data(), end, length);
+	if (error != std::errc() || parsed_end != end) {
+		return std::nullopt;
+	}
+	return length;
+}
+
+server::server(options opts) : opts(opts), maude(opts.cache_dir, opts.maude_check) {}
+
+auto server::run() -> bool {
+	// Clients that disconnect are noticed through failed writes instead
+	signal(SIGPIPE, SIG_IGN);
+
+	// Maude is started before the first request, so that even the first compilation does not wait for it
+	if (maude.processes) {
+		maude.processes->start(std::max(opts.jobs, 1U));
+	}
+
+	if (opts.socket_path.empty()) {
+		serve(STDIN_FILENO, STDOUT_FILENO);
+		return true;
+	}
+
+	auto address = sockaddr_un();
+	address.sun_family = AF_UNIX;
+	if (opts.socket_path.length() >= sizeof(address.sun_path)) {
+		return false;
+	}
+	opts.socket_path.copy(address.sun_path, opts.socket_path.length());
+
+	auto listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0) {
+		return false;
+	}
+	// A socket left behind by an earlier server would make bind fail, but anything else at the path is not ours to
+	//  remove
+	struct stat existing;
+	if (lstat(opts.socket_path.c_str(), &existing) == 0) {
+		if (!S_ISSOCK(existing.st_mode)) {
+			close(listener);
+			return false;
+		}
+		unlink(opts.socket_path.c_str());
+	}
+	if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+		close(listener);
+		return false;
+	}
+
+	while (true) {
+		auto client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+		if (client < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			close(listener);
+			break;
+		}
+
+		auto guard = std::lock_guard(clients_lock);
+		clients.insert(client);
+		std::thread([this, client] {
+			serve(client, client);
+			// The socket is closed while holding the lock, so that it cannot be shut down after its descriptor has
+			//  been reused
+			auto guard = std::lock_guard(clients_lock);
+			close(client);
+			clients.erase(client);
+			clients_done.notify_all();
+		}).detach();
+	}
+
+	// Client threads use the memo and the Maude processes, so they must all have finished before the server can be
+	//  destroyed. Shutting down their sockets ends them once any compilation in progress is answered
+	auto guard = std::unique_lock(clients_lock);
+	for (auto client : clients) {
+		shutdown(client, SHUT_RDWR);
+	}
+	clients_done.wait(guard, [&] { return clients.empty(); });
+	unlink(opts.socket_path.c_str());
+	return false;
+}
+
+void server::serve(int in, int out) {
+	auto reader = request_reader(in);
+
+	// Contents given by source requests, used by the next compile request
+	auto given = vector<glc::source>();
+	auto given_length = size_t(0);
+
+	for (auto line = string(); reader.read_line(line);) {
+		auto words = split_words(line);
+		if (words.empty()) {
+			continue;
+		}
+
+		auto response = string();
+		if (words[0] == "quit") {
+			return;
+		} else if (words[0] == "source") {
+			auto length = words.size() == 3 ? parse_length(words[2]) : std::nullopt;
+			if (!length) {
+				response = "error Expected source <path> <length>\ndone failed 0\n";
+			} else if (*length > max_source_length - given_length) {
+				response = "error Sources for one compilation cannot be longer than " + std::to_string(max_source_length) +
+					" bytes in total\ndone failed 0\n";
+			} else {
+				auto contents = string();
+				if (!reader.read_bytes(*length, contents)) {
+					return;
+				}
+				given.push_back({words[1], std::make_shared<string const>(std::move(contents))});
+				given_length += *length;
+				continue;
+			}
+		} else if (words[0] == "compile" && words.size() >= 2) {
+			auto start_time = steady_clock::now();
+
+			auto compile_opts = glc::options();
+			compile_opts.cache_dir = opts.cache_dir;
+			compile_opts.maude_check = opts.maude_check;
+			maude.share_with(compile_opts);
+			compile_opts.jobs = opts.jobs;
+			compile_opts.check_passes = opts.check_passes;
+
+			compile_opts.file_contents = std::move(given);
+			for (size_t i = 2; i < words.size(); i++) {
+				compile_opts.more_sources.push_back({words[i]});
+			}
+
+			auto result = glc::compile({words[1]}, compile_opts);
+			given.clear();
+			given_length = 0;
+
+			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(steady_clock::now() - start_time);
+			for (auto& error : result.errors) {
+				response += "error " + error + "\n";
+			}
+			response += string("done ") + (result.success ? "ok " : "failed ") + std::to_string(elapsed.count()) + "\n";
+		} else {
+			response = "error Unknown request " + line + "\ndone failed 0\n";
+		}
+
+		if (!write_all(out, response)) {
+			return;
+		}
+	}
+}
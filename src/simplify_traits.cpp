@@ -0,0 +1,147 @@
+#include "simplify_traits.h"
+#include "simplify_transition_ifs.h"
+#include "parser.h"
+#include "serialize.h"
+#include "hash.h"
+
+#include <string>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <optional>
+#include <cstdio>
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+using std::string;
+using std::unique_ptr;
+using std::optional;
+
+// Identifies the compiler that produced a cached result, so that results are not reused after glc is rebuilt
+// The executable is identified by its size and modification time, which is much cheaper than hashing it
+static auto compiler_fingerprint() -> string {
+	struct stat exe_stat;
+	if (stat("/proc/self/exe", &exe_stat) != 0) {
+		return "";
+	}
+	return std::to_string(exe_stat.st_size) + "." + std::to_string(exe_stat.st_mtim.tv_sec) + "." +
+		std::to_string(exe_stat.st_mtim.tv_nsec);
+}
+
+// Each cache entry is stored in a file named after the hash of the serialized input trait, containing
+//   <length of input>:<serialized input><serialized result>
+// where the input is compared on load so that a hash collision cannot produce a wrong result
+static auto cache_path(string const& cache_dir, string const& compiler, string const& input) -> string {
+	char hash_text[17];
+	snprintf(hash_text, sizeof(hash_text), "%016llx",
+		static_cast<unsigned long long>(hash::fnv1a(input, hash::fnv1a(compiler))));
+	return cache_dir + "/traits/" + hash_text;
+}
+
+static auto load(string const& path, string const& input) -> optional<string> {
+	auto file = std::ifstream(path, std::ios::binary);
+	if (!file) {
+		return std::nullopt;
+	}
+	auto contents_stream = std::stringstream();
+	contents_stream << file.rdbuf();
+	auto contents = contents_stream.str();
+
+	auto header = std::to_string(input.length()) + ":" + input;
+	if (contents.compare(0, header.length(), header) != 0) {
+		return std::nullopt;
+	}
+	return contents.substr(header.length());
+}
+
+static void store(string const& path, string const& input, string const& result) {
+	auto error = std::error_code();
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+	// Written to a temporary file first so that concurrent compilations never see a partial entry
+	// The name is unique to this store, since compilations in the same process may store the same entry at once
+	static auto temp_counter = std::atomic<size_t>(0);
+	auto temp_path = path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(temp_counter++);
+	{
+		auto file = std::ofstream(temp_path, std::ios::binary);
+		file << input.length() << ":" << input << result;
+		if (!file) {
+			return;
+		}
+	}
+	std::filesystem::rename(temp_path, path, error);
+	if (error) {
+		std::filesystem::remove(temp_path, error);
+	}
+}
+
+// Removes the least recently used entries once there are more than max_cached_traits of them, so that the cache
+//  does not keep growing as traits are edited. Entries that are read are touched, so their modification time is
+//  the last time they were used
+static constexpr size_t max_cached_traits = 1024;
+
+static void prune(string const& cache_dir) {
+	auto error = std::error_code();
+	auto entries = std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>>();
+	for (auto it = std::filesystem::directory_iterator(cache_dir + "/traits", error);
+			!error && it != std::filesystem::directory_iterator(); it.increment(error)) {
+		auto time = it->last_write_time(error);
+		if (!error) {
+			entries.emplace_back(time, it->path());
+		}
+	}
+	if (entries.size() <= max_cached_traits) {
+		return;
+	}
+
+	auto num_removed = entries.size() - max_cached_traits;
+	std::nth_element(entries.begin(), entries.begin() + num_removed, entries.end());
+	for (size_t i = 0; i < num_removed; i++) {
+		// Another compilation may be pruning at the same time, so entries that are already gone are ignored
+		std::filesystem::remove(entries[i].second, error);
+	}
+}
+
+simplify_traits::simplify_traits(pass_manager& pm, options opts)
+	: program(*pm.get_pass<parser>()->program)
+{
+	auto compiler = opts.cache_dir.empty() ? string() : compiler_fingerprint();
+
+	for (auto& trait : program.traits) {
+		auto path = string();
+		auto input = string();
+		if (!opts.cache_dir.empty() && !compiler.empty()) {
+			input = ast::serialize(*trait);
+			path = cache_path(opts.cache_dir, compiler, input);
+
+			if (auto cached = load(path, input)) {
+				if (auto result = ast::deserialize_trait(cached.value(), *trait)) {
+					ast::set_parent(&program, result);
+					trait = std::move(result);
+					auto error = std::error_code();
+					std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+					reused++;
+					continue;
+				}
+			}
+		}
+
+		simplify_transition_ifs::simplify_trait(*trait);
+		merge_ifs::merge_trait(program, *trait, opts.merge_opts);
+		processed++;
+
+		if (!path.empty()) {
+			store(path, input, ast::serialize(*trait));
+		}
+	}
+
+	if (processed > 0 && !opts.cache_dir.empty() && !compiler.empty()) {
+		prune(opts.cache_dir);
+	}
+}
@@ -10,12 +10,10 @@
 using std::vector;
 using std::unique_ptr;
 
-static auto unique_id_counter = 0;
-
 struct simplify_transition_ifs_visitor {
-	ast::program& program;
-
-	simplify_transition_ifs_visitor(ast::program& program) : program(program) {}
+	// Used to give each generated variable a unique name within its trait
+	// The counter is per trait so that the result for a trait does not depend on the traits before it
+	int unique_id_counter = 0;
 
 	auto simplify_transition_if(ast::transition_if& n) -> vector<ast::expression> {
 		using namespace ast;
@@ -23,7 +21,7 @@ struct simplify_transition_ifs_visitor {
 		auto new_exprs = vector<ast::expression>();
 
 		// Create a new bool variable to contain the previous value of the condition
-		auto prev_val = "prev~" + std::to_string(unique_id_counter++);
+		auto prev_val = symbol::compose("prev", std::to_string(unique_id_counter++));
 		auto prev_val_decl = variable_decl::make(variable_type::make(type_enum::BOOL, 0, 0), prev_val);
 		find_parent<trait>(n)->props->add_decl(std::move(prev_val_decl));
 
@@ -70,6 +68,12 @@ struct simplify_transition_ifs_visitor {
 simplify_transition_ifs::simplify_transition_ifs(pass_manager& pm)
 	: program(*pm.get_pass<parser>()->program)
 {
-	auto stiv = simplify_transition_ifs_visitor(program);
-	visit<ast::program, decltype(stiv)>()(program, stiv);
+	for (auto& trait : program.traits) {
+		simplify_trait(*trait);
+	}
+}
+
+void simplify_transition_ifs::simplify_trait(ast::trait& trait) {
+	auto stiv = simplify_transition_ifs_visitor();
+	visit<ast::trait, decltype(stiv)>()(trait, stiv);
 }
@@ -0,0 +1,73 @@
+#include "symbol.h"
+
+#include <deque>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+
+namespace ast {
+	// Entries are stored in a deque so that they keep their addresses as more are added
+	// Names are looked up far more often than they are added, so lookups only take the lock for reading
+	struct symbol_table {
+		std::shared_mutex lock;
+		std::deque<symbol::entry> entries;
+		std::unordered_map<std::string_view, symbol::entry const*> entries_by_name;
+		// Composed symbols by the ids of their prefix and name
+		std::unordered_map<uint64_t, symbol::entry const*> composed;
+		// The entry of the empty name, kept apart from the deque since other threads may be adding to it
+		symbol::entry const* empty;
+
+		symbol_table() {
+			empty = &entries.emplace_back(symbol::entry {"", 0});
+			entries_by_name.emplace(empty->name, empty);
+		}
+	};
+
+	// The table is created on first use, so that symbols can be created during static initialization
+	static auto table() -> symbol_table& {
+		static symbol_table result;
+		return result;
+	}
+
+	symbol::symbol() : entry_(table().empty) {}
+
+	symbol::symbol(std::string_view name) {
+		auto& t = table();
+		{
+			auto guard = std::shared_lock(t.lock);
+			auto it = t.entries_by_name.find(name);
+			if (it != t.entries_by_name.end()) {
+				entry_ = it->second;
+				return;
+			}
+		}
+
+		// Another thread may have added the name between the two locks, in which case its entry is used
+		auto guard = std::unique_lock(t.lock);
+		auto it = t.entries_by_name.find(name);
+		if (it == t.entries_by_name.end()) {
+			auto& added = t.entries.emplace_back(entry {std::string(name), static_cast<uint32_t>(t.entries.size())});
+			it = t.entries_by_name.emplace(added.name, &added).first;
+		}
+		entry_ = it->second;
+	}
+
+	auto symbol::compose(symbol prefix, symbol name) -> symbol {
+		auto& t = table();
+		auto key = static_cast<uint64_t>(prefix.id()) << 32 | name.id();
+		auto result = symbol();
+		{
+			auto guard = std::shared_lock(t.lock);
+			auto it = t.composed.find(key);
+			if (it != t.composed.end()) {
+				result.entry_ = it->second;
+				return result;
+			}
+		}
+
+		result = symbol(prefix.str() + "~" + name.str());
+		auto guard = std::unique_lock(t.lock);
+		t.composed.emplace(key, result.entry_);
+		return result;
+	}
+}
@@ -0,0 +1,58 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+thread_pool::thread_pool(unsigned num_threads) {
+	for (unsigned i = 0; i < std::max(num_threads, 1u); i++) {
+		workers.emplace_back([this, i] { run(i); });
+	}
+}
+
+thread_pool::~thread_pool() {
+	{
+		auto guard = std::lock_guard(lock);
+		stopping = true;
+	}
+	task_available.notify_all();
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+void thread_pool::submit(task t) {
+	{
+		auto guard = std::lock_guard(lock);
+		tasks.push_back(std::move(t));
+	}
+	task_available.notify_one();
+}
+
+void thread_pool::wait() {
+	auto guard = std::unique_lock(lock);
+	tasks_done.wait(guard, [this] { return tasks.empty() && running == 0; });
+}
+
+void thread_pool::run(unsigned worker) {
+	auto guard = std::unique_lock(lock);
+	while (true) {
+		task_available.wait(guard, [this] { return stopping || !tasks.empty(); });
+		if (tasks.empty()) {
+			// Only reached when stopping, since remaining tasks are drained first
+			return;
+		}
+
+		auto t = std::move(tasks.front());
+		tasks.pop_front();
+		running++;
+
+		guard.unlock();
+		t(worker);
+		guard.lock();
+
+		running--;
+		if (tasks.empty() && running == 0) {
+			tasks_done.notify_all();
+		}
+	}
+}
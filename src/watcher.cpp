@@ -0,0 +1,189 @@
+#include "watcher.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cerrno>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#define TTY_RESET "\033[0m"
+#define TTY_RED "\033[1m\033[31m"
+#define TTY_GREEN "\033[1m\033[32m"
+#define TTY_CYAN "\033[1m\033[36m"
+
+using std::string;
+using std::vector;
+using std::optional;
+
+using steady_clock = std::chrono::steady_clock;
+
+// Events that mean a file in a directory may have new contents, including saves that replace the file
+static constexpr uint32_t watched_events = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM;
+
+static auto canonical(string const& path) -> string {
+	auto error = std::error_code();
+	auto result = std::filesystem::weakly_canonical(path, error).string();
+	return error ? path : result;
+}
+
+watcher::watcher(options opts) : opts(opts), maude(opts.cache_dir, opts.maude_check) {}
+
+watcher::~watcher() {
+	if (inotify_fd >= 0) {
+		close(inotify_fd);
+	}
+}
+
+auto watcher::run() -> bool {
+	inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (inotify_fd < 0) {
+		return false;
+	}
+
+	build(std::nullopt);
+	if (directories.empty()) {
+		return false;
+	}
+
+	while (auto changed_at = wait_for_change()) {
+		build(*changed_at);
+	}
+	return true;
+}
+
+void watcher::build(optional<steady_clock::time_point> changed_at) {
+	auto start_time = steady_clock::now();
+
+	auto compile_opts = glc::options();
+	for (size_t i = 1; i < opts.input_files.size(); i++) {
+		compile_opts.more_sources.push_back({opts.input_files[i]});
+	}
+	compile_opts.cache_dir = opts.cache_dir;
+	compile_opts.maude_check = opts.maude_check;
+	maude.share_with(compile_opts);
+	compile_opts.jobs = opts.jobs;
+	compile_opts.check_passes = opts.check_passes;
+	auto result = glc::compile({opts.input_files.front()}, compile_opts);
+
+	auto end_time = steady_clock::now();
+	auto milliseconds = [](steady_clock::duration d) {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+	};
+
+	// The input files are always watched, so that a build that failed to read them is retried once they appear
+	auto program_files = opts.input_files;
+	program_files.insert(program_files.end(), result.files.begin(), result.files.end());
+	watch(program_files);
+
+	if (result.success) {
+		std::cout << TTY_GREEN << "Compilation succeeded" << TTY_RESET;
+	} else {
+		for (auto& error : result.errors) {
+			std::cout << error << std::endl;
+		}
+		std::cout << TTY_RED << "Compilation failed due to at least " << result.errors.size() <<
+			(result.errors.size() == 1 ? " error" : " errors") << TTY_RESET;
+	}
+	std::cout << " in " << milliseconds(end_time - start_time) << " ms";
+	if (changed_at) {
+		std::cout << ", " << milliseconds(end_time - *changed_at) << " ms after the change";
+	}
+	if (result.success) {
+		std::cout << " (" << result.num_files - result.num_reused_files << " of " << result.num_files << " files parsed, " <<
+			result.num_processed_traits << " of " << result.num_reused_traits + result.num_processed_traits <<
+			" traits simplified)";
+	}
+	std::cout << std::endl;
+	std::cout << TTY_CYAN << "Watching " << files.size() << (files.size() == 1 ? " file" : " files") <<
+		" for changes" << TTY_RESET << std::endl;
+}
+
+void watcher::watch(vector<string> const& program_files) {
+	files.clear();
+	auto needed = std::unordered_set<string>();
+	for (auto& file : program_files) {
+		auto path = canonical(file);
+		files.insert(path);
+		needed.insert(std::filesystem::path(path).parent_path().string());
+	}
+
+	for (auto it = directories.begin(); it != directories.end();) {
+		if (needed.erase(it->second) == 0) {
+			inotify_rm_watch(inotify_fd, it->first);
+			it = directories.erase(it);
+		} else {
+			it++;
+		}
+	}
+
+	// Directories that do not exist cannot be watched, and files in them are only noticed by a later build
+	for (auto& directory : needed) {
+		auto wd = inotify_add_watch(inotify_fd, directory.c_str(), watched_events);
+		if (wd >= 0) {
+			directories[wd] = directory;
+		}
+	}
+}
+
+auto watcher::wait_for_change() -> optional<steady_clock::time_point> {
+	// The first change to a file of the program, and the latest, which the debounce period is counted from
+	// Events for other files in the same directories are ignored, so that they cannot delay the rebuild
+	auto changed_at = optional<steady_clock::time_point>();
+	auto last_change = steady_clock::time_point();
+	alignas(inotify_event) char buffer[64 * 1024];
+
+	while (true) {
+		// Block until the first change, and then only wait until the debounce period has passed without changes
+		auto timeout = -1;
+		if (changed_at) {
+			auto remaining = last_change + opts.debounce - steady_clock::now();
+			if (remaining <= steady_clock::duration::zero()) {
+				return changed_at;
+			}
+			// Rounded up, so that poll does not return just before the deadline and spin until it passes
+			timeout = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+		}
+
+		auto pfd = pollfd { inotify_fd, POLLIN, 0 };
+		auto ready = poll(&pfd, 1, timeout);
+		if (ready < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ready < 0) {
+			return std::nullopt;
+		}
+		if (ready == 0) {
+			continue;
+		}
+
+		auto bytes_read = read(inotify_fd, buffer, sizeof(buffer));
+		if (bytes_read < 0 && (errno == EINTR || errno == EAGAIN)) {
+			continue;
+		}
+		if (bytes_read <= 0) {
+			return std::nullopt;
+		}
+
+		for (auto pos = buffer; pos < buffer + bytes_read;) {
+			auto event = reinterpret_cast<inotify_event const*>(pos);
+			pos += sizeof(inotify_event) + event->len;
+
+			auto directory = directories.find(event->wd);
+			if (directory == directories.end() || event->len == 0) {
+				continue;
+			}
+			auto path = (std::filesystem::path(directory->second) / event->name).string();
+			if (files.count(path)) {
+				last_change = steady_clock::now();
+				if (!changed_at) {
+					changed_at = last_change;
+				}
+			}
+		}
+	}
+}